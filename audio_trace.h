@@ -0,0 +1,182 @@
+/*
+    Binary TIA audio register trace
+
+    Written by the emulator with --audio-trace and read by trace_to_pcm.
+    The file is a header and then records back to back:
+
+        header  "TIATRACE", uint32 version, uint32 clock rate, little-endian
+        record  clock delta from the previous record as a LEB128 varint,
+                then register byte and value byte
+
+    Register bytes 0x80 and above are records that aren't register
+    writes; their value byte is the length of a payload that follows.
+
+        KEYFRAME    TIAAudio::keyframe at the record's clock, from which
+                    trace_to_pcm can start rendering a chunk of the trace
+*/
+
+#ifndef AUDIO_TRACE_H
+#define AUDIO_TRACE_H
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace AudioTrace
+{
+    static constexpr char magic[8] = {'T', 'I', 'A', 'T', 'R', 'A', 'C', 'E'};
+    static constexpr uint32_t version = 1;
+    static constexpr size_t header_size = 16;
+    static constexpr size_t max_record_size = 12;
+
+    enum {
+        KEYFRAME = 0x80,
+    };
+
+    inline void put_u32(uint8_t *p, uint32_t v)
+    {
+        p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+    }
+
+    inline uint32_t get_u32(const uint8_t *p)
+    {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    inline size_t put_varint(uint8_t *p, uint64_t v)
+    {
+        size_t n = 0;
+        while(v >= 0x80) {
+            p[n++] = (v & 0x7f) | 0x80;
+            v >>= 7;
+        }
+        p[n++] = v;
+        return n;
+    }
+}
+
+struct audio_trace_writer
+{
+    FILE *file = nullptr;
+    uint64_t previous_clock = 0;
+
+    bool open(const char *filename, uint32_t clock_rate)
+    {
+        file = fopen(filename, "wb");
+        if(file == nullptr) {
+            return false;
+        }
+        // stdio does the batching and exit() flushes it
+        setvbuf(file, nullptr, _IOFBF, 1 << 20);
+        uint8_t header[AudioTrace::header_size];
+        memcpy(header, AudioTrace::magic, sizeof(AudioTrace::magic));
+        AudioTrace::put_u32(header + 8, AudioTrace::version);
+        AudioTrace::put_u32(header + 12, clock_rate);
+        fwrite(header, sizeof(header), 1, file);
+        return true;
+    }
+
+    void write(uint64_t clock, uint8_t reg, uint8_t value)
+    {
+        uint8_t record[AudioTrace::max_record_size];
+        size_t size = AudioTrace::put_varint(record, clock - previous_clock);
+        record[size++] = reg;
+        record[size++] = value;
+        fwrite(record, size, 1, file);
+        previous_clock = clock;
+    }
+
+    void write_payload(uint64_t clock, uint8_t type, const uint8_t *payload, uint8_t length)
+    {
+        write(clock, type, length);
+        fwrite(payload, length, 1, file);
+    }
+};
+
+struct audio_trace_reader
+{
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    size_t position = 0;
+    uint64_t clock = 0;
+    uint32_t clock_rate = 0;
+    const uint8_t *payload = nullptr;
+
+    bool open(const char *filename)
+    {
+        int fd = ::open(filename, O_RDONLY);
+        if(fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if((fstat(fd, &st) != 0) || (st.st_size < (off_t)AudioTrace::header_size)) {
+            ::close(fd);
+            return false;
+        }
+        size = st.st_size;
+        void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if(mapped == MAP_FAILED) {
+            return false;
+        }
+        data = static_cast<const uint8_t*>(mapped);
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        if((memcmp(data, AudioTrace::magic, sizeof(AudioTrace::magic)) != 0) ||
+            (AudioTrace::get_u32(data + 8) != AudioTrace::version)) {
+            close();
+            return false;
+        }
+        clock_rate = AudioTrace::get_u32(data + 12);
+        position = AudioTrace::header_size;
+        return true;
+    }
+
+    void close()
+    {
+        if(data != nullptr) {
+            munmap(const_cast<uint8_t*>(data), size);
+            data = nullptr;
+        }
+    }
+
+    // Returns false at end of trace or on a truncated or corrupt record.
+    // For records of reg 0x80 and up, "value" bytes at "payload" follow.
+    bool next(uint64_t& record_clock, uint8_t& reg, uint8_t& value)
+    {
+        uint64_t delta = 0;
+        int shift = 0;
+        while(position < size) {
+            if(shift > 63) {
+                return false; // a varint longer than any 64-bit delta
+            }
+            uint8_t b = data[position++];
+            delta |= (uint64_t)(b & 0x7f) << shift;
+            shift += 7;
+            if(!(b & 0x80)) {
+                if(position + 2 > size) {
+                    return false;
+                }
+                clock += delta;
+                record_clock = clock;
+                reg = data[position++];
+                value = data[position++];
+                if(reg >= 0x80) {
+                    if(position + value > size) {
+                        return false;
+                    }
+                    payload = data + position;
+                    position += value;
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+#endif /* AUDIO_TRACE_H */
@@ -0,0 +1,181 @@
+/*
+    Band-limited step synthesis
+
+    The TIA's audio output is a square wave that only changes level on
+    audio clocks.  Instead of point-sampling it, each change of level is
+    added to a buffer as a band-limited impulse (a windowed sinc picked
+    from one of "phases" sub-sample offsets), and reading integrates the
+    buffer back into steps.  Cost is one short kernel per level change
+    plus one add per output sample, for any output rate.
+
+    Times passed to add_delta() are in input clocks since the last
+    end_frame(), 64 bits wide so a long span between frames can't wrap.
+*/
+
+#ifndef BAND_LIMITED_H
+#define BAND_LIMITED_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cinttypes>
+#include <vector>
+
+struct band_limited_synth
+{
+    static constexpr int phase_bits = 5;
+    static constexpr int phases = 1 << phase_bits;
+    static constexpr int taps = 16;
+    static constexpr int kernel_bits = 15;
+    static constexpr int fraction_bits = 32;
+
+    typedef int16_t kernel_t[phases][taps];
+
+    uint64_t factor = 0; // output samples per input clock, 32.32 fixed point
+    uint64_t offset = 0; // position of current frame start in buffer, 32.32 fixed point
+    std::vector<int32_t> buffer;
+    int32_t integrator = 0;
+
+    struct kernel_table
+    {
+        kernel_t values;
+    };
+
+    // Lowpass at 90% of output Nyquist, Blackman window; built once, the
+    // first time any thread asks
+    static const kernel_t& kernel()
+    {
+        static const kernel_table table = []{
+            kernel_table t{};
+            const double cutoff = 0.9;
+            for(int phase = 0; phase < phases; phase++) {
+                double fraction = phase / (double)phases;
+                double values[taps];
+                double sum = 0;
+                for(int tap = 0; tap < taps; tap++) {
+                    double x = tap - taps / 2 + 1 - fraction;
+                    double sinc = (x == 0) ? 1.0 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+                    double w = (tap + 1 - fraction) / taps;
+                    double window = 0.42 - 0.5 * cos(2 * M_PI * w) + 0.08 * cos(4 * M_PI * w);
+                    values[tap] = sinc * window;
+                    sum += values[tap];
+                }
+                // Each phase sums to exactly 1 << kernel_bits so steps don't drift
+                int16_t *k = t.values[phase];
+                int total = 0;
+                int largest = 0;
+                for(int tap = 0; tap < taps; tap++) {
+                    k[tap] = (int16_t)lrint(values[tap] / sum * (1 << kernel_bits));
+                    total += k[tap];
+                    if(k[tap] > k[largest]) {
+                        largest = tap;
+                    }
+                }
+                k[largest] += (1 << kernel_bits) - total;
+            }
+            return t;
+        }();
+        return table.values;
+    }
+
+    void set_rates(uint64_t clock_rate, uint32_t sample_rate)
+    {
+        kernel();
+        set_sample_rate(clock_rate, sample_rate);
+        offset = 0;
+        integrator = 0;
+        buffer.assign(1024 + taps, 0);
+    }
+
+    // Can be changed between frames, e.g. for rate control
+    void set_sample_rate(uint64_t clock_rate, double sample_rate)
+    {
+        factor = (uint64_t)(sample_rate * ((uint64_t)1 << fraction_bits) / clock_rate + 0.5);
+    }
+
+    // Output sample that "clock" input clocks from the start falls in
+    uint64_t sample_index(uint64_t clock) const
+    {
+        return ((unsigned __int128)clock * factor) >> fraction_bits;
+    }
+
+    // Start over with the buffer beginning at sample_index(clock), where
+    // every step before "clock" has settled at "level"
+    void seek(uint64_t clock, int level)
+    {
+        offset = (clock * factor) & (((uint64_t)1 << fraction_bits) - 1);
+        integrator = level * (1 << kernel_bits);
+        std::fill(buffer.begin(), buffer.end(), 0);
+    }
+
+    void add_delta(uint64_t clock, int delta)
+    {
+        uint64_t position = offset + clock * factor;
+        size_t index = position >> fraction_bits;
+        int phase = (position >> (fraction_bits - phase_bits)) & (phases - 1);
+        if(index + taps > buffer.size()) {
+            buffer.resize(index + taps, 0);
+        }
+        const int16_t *k = kernel()[phase];
+        int32_t *out = buffer.data() + index;
+        for(int tap = 0; tap < taps; tap++) {
+            out[tap] += k[tap] * delta;
+        }
+    }
+
+    void end_frame(uint64_t clocks)
+    {
+        offset += clocks * factor;
+        size_t needed = (offset >> fraction_bits) + taps;
+        if(needed > buffer.size()) {
+            buffer.resize(needed, 0);
+        }
+    }
+
+    size_t samples_available() const
+    {
+        return offset >> fraction_bits;
+    }
+
+    // Writes count samples, biased by "bias", every "stride" bytes
+    void read_samples(uint8_t *out, size_t count, int stride, int bias)
+    {
+        for(size_t i = 0; i < count; i++) {
+            integrator += buffer[i];
+            int value = bias + ((integrator + (1 << (kernel_bits - 1))) >> kernel_bits);
+            out[i * stride] = (value < 0) ? 0 : ((value > 255) ? 255 : value);
+        }
+        remove_samples(count);
+    }
+
+    // As 16-bit samples, 256 to each step of the 8-bit output, unbiased
+    void read_samples(int16_t *out, size_t count, int stride)
+    {
+        for(size_t i = 0; i < count; i++) {
+            integrator += buffer[i];
+            int value = (integrator + (1 << (kernel_bits - 9))) >> (kernel_bits - 8);
+            out[i * stride] = std::clamp(value, -32768, 32767);
+        }
+        remove_samples(count);
+    }
+
+    // As float samples, 128 steps of the 8-bit output to 1.0, unbiased
+    void read_samples(float *out, size_t count, int stride)
+    {
+        for(size_t i = 0; i < count; i++) {
+            integrator += buffer[i];
+            out[i * stride] = integrator * (1.0f / (128 << kernel_bits));
+        }
+        remove_samples(count);
+    }
+
+    void remove_samples(size_t count)
+    {
+        size_t remaining = (offset >> fraction_bits) - count + taps;
+        memmove(buffer.data(), buffer.data() + count, remaining * sizeof(buffer[0]));
+        memset(buffer.data() + remaining, 0, count * sizeof(buffer[0]));
+        offset -= (uint64_t)count << fraction_bits;
+    }
+};
+
+#endif /* BAND_LIMITED_H */
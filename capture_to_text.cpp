@@ -0,0 +1,82 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cinttypes>
+
+#include "stella.h"
+#include "register_capture.h"
+
+// Prints a --capture file, one access per line:
+//     frame scanline hclock clock R|W address register value [HBLANK]
+
+const char *register_name(const register_access& r)
+{
+    using namespace Stella;
+
+    static const char *TIA_read_names[16] = {
+        "CXM0P", "CXM1P", "CXP0FB", "CXP1FB", "CXM0FB", "CXM1FB", "CXBLPF", "CXPPMM",
+        "INPT0", "INPT1", "INPT2", "INPT3", "INPT4", "INPT5", "?", "?",
+    };
+
+    if((r.address & address_mask) == PIA_select_value) {
+        switch(r.address & 0x1F) {
+            case SWCHA: return "SWCHA";
+            case SWACNT: return "SWACNT";
+            case SWCHB: return "SWCHB";
+            case SWBCNT: return "SWBCNT";
+            case INTIM: return "INTIM";
+            case INSTAT: return "INSTAT";
+            case TIM1T: return "TIM1T";
+            case TIM8T: return "TIM8T";
+            case TIM64T: return "TIM64T";
+            case T1024T: return "T1024T";
+            default: return "?";
+        }
+    }
+    if(!(r.flags & RegisterCapture::WRITE)) {
+        return TIA_read_names[r.address & 0xF];
+    }
+    auto found = TIA_register_names.find(r.address & 0x3F);
+    return (found != TIA_register_names.end()) ? found->second.c_str() : "?";
+}
+
+int main(int argc, const char **argv)
+{
+    if(argc != 2) {
+        fprintf(stderr, "usage: %s capture-file\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if(file == nullptr) {
+        fprintf(stderr, "couldn't open %s for reading\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    using namespace RegisterCapture;
+
+    uint8_t header[header_size];
+    if(fread(header, sizeof(header), 1, file) != 1) {
+        fprintf(stderr, "%s is too short to be a capture\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    if((memcmp(header, magic, sizeof(magic)) != 0) ||
+        (get_le(header + 8, 4) != version) || (get_le(header + 12, 4) != record_size)) {
+        fprintf(stderr, "%s isn't a version %u capture\n", argv[1], version);
+        exit(EXIT_FAILURE);
+    }
+
+    static uint8_t records[4096 * record_size];
+    size_t count;
+    while((count = fread(records, record_size, sizeof(records) / record_size, file)) > 0) {
+        for(size_t i = 0; i < count; i++) {
+            register_access r;
+            r.decode(records + i * record_size);
+            printf("%6llu %3u %3u %12llu %c %04X %-6s %02X%s\n",
+                (unsigned long long)r.frame, r.scanline, r.hclock, (unsigned long long)r.clock,
+                (r.flags & RegisterCapture::WRITE) ? 'W' : 'R',
+                r.address, register_name(r), r.value,
+                (r.flags & RegisterCapture::HBLANK) ? " HBLANK" : "");
+        }
+    }
+}
@@ -6,6 +6,12 @@
         irq() - put CPU in IRQ
         nmi() - put CPU in NMI
 
+    With PROFILE_6502 set to 1, cycle() also adds up executions, cycles,
+    and extra cycles from taken branches and crossed pages for every
+    instruction address in "profile", a flat 64K-entry array, keeping
+    the instruction's bytes for disassembly.  With 0, the default, none
+    of that is compiled in.
+
     CLK template parameter must provide methods:
         void add_cpu_cycles(int N); - add N CPU cycles to the clock
 
@@ -27,12 +33,17 @@
 
 #include <stdlib.h>
 #include <assert.h>
+#include <string.h>
 #include <vector>
 
 #ifndef EMULATE_65C02
 #define EMULATE_65C02 0
 #endif /* EMULATE_65C02 */
 
+#ifndef PROFILE_6502
+#define PROFILE_6502 0
+#endif /* PROFILE_6502 */
+
 template<class CLK, class BUS>
 struct CPU6502
 {
@@ -58,6 +69,23 @@ struct CPU6502
         INT,
     } exception;
 
+    static constexpr bool profiling = PROFILE_6502;
+
+    struct profile_entry
+    {
+        uint64_t executions;
+        uint64_t cycles;
+        uint64_t extra_cycles; // taken branches and crossed pages
+        uint8_t bytes[4]; // as last executed, so bank switching doesn't matter
+    };
+
+    std::vector<profile_entry> profile; // indexed by address, empty unless profiling
+    bool profile_paused = false; // e.g. while run-ahead frames are thrown away
+    uint16_t instruction_pc = 0;
+    uint32_t instruction_cycles = 0;
+    uint32_t instruction_extra_cycles = 0;
+    uint8_t instruction_bytes[4] = {};
+
     // XXX For debugging, normally couldn't set CPU PC directly
     void set_pc(uint16_t addr)
     {
@@ -65,15 +93,31 @@ struct CPU6502
         exception = NONE;
     }
 
+    void add_cycles(int n)
+    {
+        clk.add_cpu_cycles(n);
+        if constexpr(profiling) {
+            instruction_cycles += n;
+        }
+    }
+
+    void add_extra_cycle()
+    {
+        add_cycles(1);
+        if constexpr(profiling) {
+            instruction_extra_cycles++;
+        }
+    }
+
     uint8_t read(uint16_t address)
     {
-        clk.add_cpu_cycles(1);
+        add_cycles(1);
         return bus.read(address);
     }
 
     void write(uint16_t address, uint8_t value)
     {
-        clk.add_cpu_cycles(1);
+        add_cycles(1);
         bus.write(address, value);
     }
 
@@ -89,6 +133,14 @@ struct CPU6502
 
     uint8_t read_pc_inc()
     {
+        if constexpr(profiling) {
+            uint8_t d = read(pc);
+            uint16_t offset = pc++ - instruction_pc;
+            if(offset < sizeof(instruction_bytes)) {
+                instruction_bytes[offset] = d;
+            }
+            return d;
+        }
         return read(pc++);
     }
 
@@ -173,6 +225,9 @@ struct CPU6502
         p(I | B | B2 | Z), // XXX flooh m6502 starts up with Z set...?
         exception(RESET)
     {
+        if constexpr(profiling) {
+            profile.resize(65536);
+        }
     }
 
     void reset()
@@ -246,7 +301,7 @@ struct CPU6502
         a = (ah<<4) | (al & 0x0F);
 #endif
 #if EMULATE_65C02
-        clk.add_cpu_cycles(1); // 1 more cycle for decimal mode on 65C02
+        add_cycles(1); // 1 more cycle for decimal mode on 65C02
 #endif /* EMULATE_65C02 */
     }
 
@@ -294,7 +349,7 @@ struct CPU6502
         a = (ah<<4) | (al & 0x0F);
 #endif
 #if EMULATE_65C02
-        clk.add_cpu_cycles(1); // 1 more cycle for decimal mode on 65C02
+        add_cycles(1); // 1 more cycle for decimal mode on 65C02
 #endif /* EMULATE_65C02 */
     }
 
@@ -302,9 +357,9 @@ struct CPU6502
     {
         int32_t rel = (read_pc_inc() + 128) % 256 - 128;
         if(condition) {
-            clk.add_cpu_cycles(1); // 1 more cycle if branch taken
+            add_extra_cycle(); // 1 more cycle if branch taken
             if((pc + rel) / 256 != pc / 256) {
-                clk.add_cpu_cycles(1); // 1 more cycle if address crosses pages
+                add_extra_cycle(); // 1 more cycle if address crosses pages
             }
             pc += rel;
         }
@@ -356,14 +411,14 @@ struct CPU6502
     uint16_t zeropage_indexed_X()
     {
         uint8_t address = (read_pc_inc() + x) & 0xFF;
-        clk.add_cpu_cycles(1);
+        add_cycles(1);
         return address;
     }
 
     uint16_t zeropage_indexed_Y()
     {
         uint8_t address = (read_pc_inc() + y) & 0xFF;
-        clk.add_cpu_cycles(1);
+        add_cycles(1);
         return address;
     }
 
@@ -374,8 +429,10 @@ struct CPU6502
         uint8_t high = read((zpg + 1) & 0xFF);
         uint16_t base = low + high * 256;
         uint16_t address = base + y;
-        if(is_write || ((base & 0xFF00) != (address & 0xFF00))) {
-            clk.add_cpu_cycles(1);
+        if(is_write) {
+            add_cycles(1);
+        } else if((base & 0xFF00) != (address & 0xFF00)) {
+            add_extra_cycle(); // 1 more cycle if address crosses pages
         }
         return address;
     }
@@ -383,7 +440,7 @@ struct CPU6502
     uint16_t indexed_indirect()
     {
         uint8_t zpg = (read_pc_inc() + x) & 0xFF;
-        clk.add_cpu_cycles(1);
+        add_cycles(1);
         uint8_t low = read(zpg);
         uint8_t high = read((zpg + 1) & 0xFF);
         uint16_t address = low + high * 256;
@@ -396,8 +453,10 @@ struct CPU6502
         uint8_t high = read_pc_inc();
         uint16_t base = low + high * 256;
         uint16_t address = base + x;
-        if(is_write || ((base & 0xFF00) != (address & 0xFF00))) {
-            clk.add_cpu_cycles(1);
+        if(is_write) {
+            add_cycles(1);
+        } else if((base & 0xFF00) != (address & 0xFF00)) {
+            add_extra_cycle(); // 1 more cycle if address crosses pages
         }
         return address;
     }
@@ -408,8 +467,10 @@ struct CPU6502
         uint8_t high = read_pc_inc();
         uint16_t base = low + high * 256;
         uint16_t address = base + y;
-        if(is_write || ((base & 0xFF00) != (address & 0xFF00))) {
-            clk.add_cpu_cycles(1);
+        if(is_write) {
+            add_cycles(1);
+        } else if((base & 0xFF00) != (address & 0xFF00)) {
+            add_extra_cycle(); // 1 more cycle if address crosses pages
         }
         return address;
     }
@@ -425,6 +486,12 @@ struct CPU6502
         }
         // BRK is a special case caused directly by an instruction
 
+        if constexpr(profiling) {
+            instruction_pc = pc;
+            instruction_cycles = 0;
+            instruction_extra_cycles = 0;
+        }
+
         uint8_t inst = read_pc_inc();
 
         uint8_t m;
@@ -435,114 +502,114 @@ struct CPU6502
             case 0x0A: { // ASL A
                 flag_change(C, a & 0x80);
                 set_flags(N | Z, a = a << 1);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 break;
             }
 
             case 0xEA: { // NOP
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 break;
             }
 
             case 0x8A: { // TXA impl
                 set_flags(N | Z, a = x);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 break;
             }
 
             case 0xAA: { // TAX impl
                 set_flags(N | Z, x = a);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 break;
             }
 
             case 0xBA: { // TSX impl
                 set_flags(N | Z, x = s);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 break;
             }
 
             case 0x9A: { // TXS impl
                 s = x;
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 break;
             }
 
             case 0xA8: { // TAY impl
                 set_flags(N | Z, y = a);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 break;
             }
 
             case 0x98: { // TYA impl
                 set_flags(N | Z, a = y);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 break;
             }
 
             case 0x18: { // CLC impl
                 flag_clear(C);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 break;
             }
 
             case 0x38: { // SEC impl
                 flag_set(C);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 break;
             }
 
             case 0xF8: { // SED impl
                 flag_set(D);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 break;
             }
 
             case 0xD8: { // CLD impl
                 flag_clear(D);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 break;
             }
 
             case 0x58: { // CLI impl
                 flag_clear(I);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 break;
             }
 
             case 0x78: { // SEI impl
                 flag_set(I);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 break;
             }
 
             case 0xB8: { // CLV impl
                 flag_clear(V);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 break;
             }
 
             case 0xCA: { // DEX impl
                 set_flags(N | Z, x = x - 1);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 break;
             }
 
             case 0x88: { // DEY impl
                 set_flags(N | Z, y = y - 1);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 break;
             }
 
             case 0xE8: { // INX impl
                 set_flags(N | Z, x = x + 1);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 break;
             }
 
             case 0xC8: { // INY impl
                 set_flags(N | Z, y = y + 1);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 break;
             }
 
@@ -654,7 +721,7 @@ struct CPU6502
 #endif /* EMULATE_65C02 */
                 uint8_t low = read(0xFFFE);
                 uint8_t high = read(0xFFFF);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 pc = low + high * 256;
                 exception = NONE;
                 break;
@@ -665,7 +732,7 @@ struct CPU6502
                 uint16_t addr = absolute();
                 stack_push(to_push >> 8);
                 stack_push(to_push & 0xFF);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 pc = addr;
                 break;
             }
@@ -673,7 +740,7 @@ struct CPU6502
             case 0xC6: { // DEC zpg
                 uint8_t zpg = zeropage();
                 set_flags(N | Z, m = read(zpg) - 1);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 write(zpg, m);
                 break;
             }
@@ -681,7 +748,7 @@ struct CPU6502
             case 0xD6: { // DEC zpg, X
                 uint8_t zpg = zeropage_indexed_X();
                 set_flags(N | Z, m = read(zpg) - 1);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 write(zpg, m);
                 break;
             }
@@ -689,7 +756,7 @@ struct CPU6502
             case 0xCE: { // DEC abs
                 uint16_t addr = absolute();
                 set_flags(N | Z, m = read(addr) - 1);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 write(addr, m);
                 break;
             }
@@ -697,7 +764,7 @@ struct CPU6502
             case 0xDE: { // DEC abs, X
                 uint16_t addr = absolute_indexed_X(true);
                 set_flags(N | Z, m = read(addr) - 1);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 write(addr, m);
                 break;
             }
@@ -705,7 +772,7 @@ struct CPU6502
             case 0xE6: { // INC zpg
                 uint8_t zpg = zeropage();
                 set_flags(N | Z, m = read(zpg) + 1);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 write(zpg, m);
                 break;
             }
@@ -713,7 +780,7 @@ struct CPU6502
             case 0xF6: { // INC zpg, X
                 uint8_t zpg = zeropage_indexed_X();
                 set_flags(N | Z, m = read(zpg) + 1);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 write(zpg, m);
                 break;
             }
@@ -721,7 +788,7 @@ struct CPU6502
             case 0xEE: { // INC abs
                 uint16_t addr = absolute();
                 set_flags(N | Z, m = read(addr) + 1);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 write(addr, m);
                 break;
             }
@@ -729,7 +796,7 @@ struct CPU6502
             case 0xFE: { // INC abs, X
                 uint16_t addr = absolute_indexed_X(true);
                 set_flags(N | Z, m = read(addr) + 1);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 write(addr, m);
                 break;
             }
@@ -801,7 +868,7 @@ struct CPU6502
 
             case 0x4A: { // LSR A
                 flag_change(C, a & 0x01);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 set_flags(N | Z, a = a >> 1);
                 break;
             }
@@ -809,7 +876,7 @@ struct CPU6502
             case 0x2A: { // ROL A
                 bool c = isset(C);
                 flag_change(C, a & 0x80);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 set_flags(N | Z, a = (c ? 0x01 : 0x00) | (a << 1));
                 break;
             }
@@ -817,7 +884,7 @@ struct CPU6502
             case 0x6A: { // ROR A
                 bool c = isset(C);
                 flag_change(C, a & 0x01);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 set_flags(N | Z, a = (c ? 0x80 : 0x00) | (a >> 1));
                 break;
             }
@@ -1026,7 +1093,7 @@ struct CPU6502
             case 0x0E: { // ASL abs
                 uint16_t addr = absolute();
                 m = read(addr);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 flag_change(C, m & 0x80);
                 set_flags(N | Z, m = m << 1);
                 write(addr, m);
@@ -1040,7 +1107,7 @@ struct CPU6502
                 uint16_t addr = absolute_indexed_X(true);
 #endif /* EMULATE_65C02 */
                 m = read(addr);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 flag_change(C, m & 0x80);
                 set_flags(N | Z, m = m << 1);
                 write(addr, m);
@@ -1050,7 +1117,7 @@ struct CPU6502
             case 0x06: { // ASL zpg
                 uint8_t zpg = zeropage();
                 m = read(zpg);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 flag_change(C, m & 0x80);
                 set_flags(N | Z, m = m << 1);
                 write(zpg, m);
@@ -1060,7 +1127,7 @@ struct CPU6502
             case 0x16: { // ASL zpg, X
                 uint8_t zpg = zeropage_indexed_X();
                 m = read(zpg);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 flag_change(C, m & 0x80);
                 set_flags(N | Z, m = m << 1);
                 write(zpg, m);
@@ -1074,7 +1141,7 @@ struct CPU6502
                 uint16_t addr = absolute_indexed_X(true);
 #endif /* EMULATE_65C02 */
                 m = read(addr);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 flag_change(C, m & 0x01);
                 set_flags(N | Z, m = m >> 1);
                 write(addr, m);
@@ -1084,7 +1151,7 @@ struct CPU6502
             case 0x46: { // LSR zpg
                 uint8_t zpg = zeropage();
                 m = read(zpg);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 flag_change(C, m & 0x01);
                 set_flags(N | Z, m = m >> 1);
                 write(zpg, m);
@@ -1094,7 +1161,7 @@ struct CPU6502
             case 0x56: { // LSR zpg, X
                 uint8_t zpg = zeropage_indexed_X();
                 m = read(zpg);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 flag_change(C, m & 0x01);
                 set_flags(N | Z, m = m >> 1);
                 write(zpg, m);
@@ -1104,7 +1171,7 @@ struct CPU6502
             case 0x4E: { // LSR abs
                 uint16_t addr = absolute();
                 m = read(addr);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 flag_change(C, m & 0x01);
                 set_flags(N | Z, m = m >> 1);
                 write(addr, m);
@@ -1112,14 +1179,14 @@ struct CPU6502
             }
 
             case 0x68: { // PLA
-                clk.add_cpu_cycles(1);
-                clk.add_cpu_cycles(1); // Pipelined pre-increment
+                add_cycles(1);
+                add_cycles(1); // Pipelined pre-increment
                 set_flags(N | Z, a = stack_pull());
                 break;
             }
 
             case 0x48: { // PHA
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 stack_push(a);
                 break;
             }
@@ -1243,7 +1310,7 @@ struct CPU6502
                 uint16_t addr = absolute_indexed_X(true);
 #endif /* EMULATE_65C02 */
                 m = read(addr);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 bool c = isset(C);
                 flag_change(C, m & 0x01);
                 set_flags(N | Z, m = (c ? 0x80 : 0x00) | (m >> 1));
@@ -1254,7 +1321,7 @@ struct CPU6502
             case 0x36: { // ROL zpg, X
                 uint8_t zpg = zeropage_indexed_X();
                 m = read(zpg);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 bool c = isset(C);
                 flag_change(C, m & 0x80);
                 set_flags(N | Z, m = (c ? 0x01 : 0x00) | (m << 1));
@@ -1270,7 +1337,7 @@ struct CPU6502
                 uint16_t addr = absolute_indexed_X(true);
 #endif /* EMULATE_65C02 */
                 m = read(addr);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 bool c = isset(C);
                 flag_change(C, m & 0x80);
                 set_flags(N | Z, m = (c ? 0x01 : 0x00) | (m << 1));
@@ -1281,7 +1348,7 @@ struct CPU6502
             case 0x6E: { // ROR abs
                 uint16_t addr = absolute();
                 m = read(addr);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 bool c = isset(C);
                 flag_change(C, m & 0x01);
                 set_flags(N | Z, m = (c ? 0x80 : 0x00) | (m >> 1));
@@ -1292,7 +1359,7 @@ struct CPU6502
             case 0x66: { // ROR zpg
                 uint8_t zpg = zeropage();
                 m = read(zpg);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 bool c = isset(C);
                 flag_change(C, m & 0x01);
                 set_flags(N | Z, m = (c ? 0x80 : 0x00) | (m >> 1));
@@ -1303,7 +1370,7 @@ struct CPU6502
             case 0x76: { // ROR zpg, X
                 uint8_t zpg = zeropage_indexed_X();
                 m = read(zpg);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 bool c = isset(C);
                 flag_change(C, m & 0x01);
                 set_flags(N | Z, m = (c ? 0x80 : 0x00) | (m >> 1));
@@ -1314,7 +1381,7 @@ struct CPU6502
             case 0x2E: { // ROL abs
                 uint16_t addr = absolute();
                 m = read(addr);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 bool c = isset(C);
                 flag_change(C, m & 0x80);
                 set_flags(N | Z, m = (c ? 0x01 : 0x00) | (m << 1));
@@ -1327,7 +1394,7 @@ struct CPU6502
                 uint8_t zpg = zeropage();
                 bool c = isset(C);
                 m = read(zpg);
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 flag_change(C, m & 0x80);
                 set_flags(N | Z, m = (c ? 0x01 : 0x00) | (m << 1));
                 write(zpg, m);
@@ -1377,14 +1444,14 @@ struct CPU6502
             }
 
             case 0x08: { // PHP
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 stack_push(p | B2 | B);
                 break;
             }
 
             case 0x28: { // PLP
-                clk.add_cpu_cycles(1);
-                clk.add_cpu_cycles(1); // Pipelined pre-increment
+                add_cycles(1);
+                add_cycles(1); // Pipelined pre-increment
                 p = stack_pull() | B2 | B;
                 break;
             }
@@ -1634,9 +1701,9 @@ struct CPU6502
             }
 
             case 0x40: { // RTI
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 p = stack_pull() | B2 | B;
-                clk.add_cpu_cycles(1); // Pipelined pre-increment
+                add_cycles(1); // Pipelined pre-increment
                 uint8_t pcl = stack_pull();
                 uint8_t pch = stack_pull();
                 pc = pcl + pch * 256;
@@ -1644,11 +1711,11 @@ struct CPU6502
             }
 
             case 0x60: { // RTS
-                clk.add_cpu_cycles(1);
-                clk.add_cpu_cycles(1); // Pipelined pre-increment
+                add_cycles(1);
+                add_cycles(1); // Pipelined pre-increment
                 uint8_t pcl = stack_pull();
                 uint8_t pch = stack_pull();
-                clk.add_cpu_cycles(1);
+                add_cycles(1);
                 pc = pcl + pch * 256 + 1;
                 break;
             }
@@ -1721,7 +1788,7 @@ struct CPU6502
                 int32_t rel = (read_pc_inc() + 128) & 0xFF - 128;
                 if(!(m & (1 << whichbit))) {
                     // if((pc + rel) / 256 != pc / 256)
-                        // clk.add_cpu_cycles(1); // XXX ???
+                        // add_cycles(1); // XXX ???
                     pc += rel;
                 }
                 break;
@@ -1735,7 +1802,7 @@ struct CPU6502
                 int32_t rel = (read_pc_inc() + 128) & 0xFF - 128;
                 if(m & (1 << whichbit)) {
                     // if((pc + rel) / 256 != pc / 256)
-                        // clk.add_cpu_cycles(1); // XXX ???
+                        // add_cycles(1); // XXX ???
                     pc += rel;
                 }
                 break;
@@ -1747,13 +1814,13 @@ struct CPU6502
             }
 
             case 0x7A: { // PLY, 65C02
-                clk.add_cpu_cycles(1); // Pipelined pre-increment
+                add_cycles(1); // Pipelined pre-increment
                 set_flags(N | Z, y = stack_pull());
                 break;
             }
 
             case 0xFA: { // PLX, 65C02
-                clk.add_cpu_cycles(1); // Pipelined pre-increment
+                add_cycles(1); // Pipelined pre-increment
                 set_flags(N | Z, x = stack_pull());
                 break;
             }
@@ -1929,6 +1996,16 @@ struct CPU6502
                 exit(1);
             }
         }
+
+        if constexpr(profiling) {
+            if(!profile_paused) {
+                profile_entry& entry = profile[instruction_pc];
+                entry.executions++;
+                entry.cycles += instruction_cycles;
+                entry.extra_cycles += instruction_extra_cycles;
+                memcpy(entry.bytes, instruction_bytes, sizeof(entry.bytes));
+            }
+        }
     }
 };
 
@@ -0,0 +1,157 @@
+/*
+    Compile-time debug categories and a buffered, asynchronous logger
+
+    Categories are chosen when building, e.g. "make DEBUG=0x3" for TIA
+    and timer messages; the default of 0 compiles every message out.
+    Callers test the mask with "if constexpr", so a disabled category
+    costs nothing, not even a branch.
+
+    Enabled messages are posted as small fixed-size records onto a
+    lock-free ring, and a background thread formats and writes them to
+    stdout in batches, so the emulation thread never calls printf or
+    looks up register names.  Nothing is dropped; if the writer falls
+    behind, post() waits for room.
+*/
+
+#ifndef DEBUG_LOG_H
+#define DEBUG_LOG_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cinttypes>
+#include <string>
+#include <thread>
+
+#include "stella.h"
+#include "ring_buffer.h"
+
+#ifndef STELLA_DEBUG
+#define STELLA_DEBUG 0
+#endif
+
+namespace DebugLog
+{
+    enum {
+        TIA = 0x0001,
+        TIMER = 0x0002,
+        PIA = 0x0004,
+        RAM = 0x0008,
+    };
+
+    static constexpr uint32_t mask = STELLA_DEBUG;
+
+    enum kind : uint8_t {
+        TIA_READ,
+        TIA_WRITE,
+        PIA_READ,
+        RAM_WRITE,
+        TIMER_TICK,
+        TIMER_READ,
+        TIMER_STATUS_READ,
+    };
+};
+
+struct debug_record
+{
+    DebugLog::kind kind;
+    uint8_t value;
+    uint16_t address;
+    uint16_t scanline;
+    uint16_t hclock;
+};
+
+struct debug_logger
+{
+    spsc_ring_buffer<debug_record, 1 << 16> queue;
+    std::atomic<bool> running{false};
+    std::thread writer;
+
+    ~debug_logger()
+    {
+        if(running) {
+            running = false;
+            writer.join();
+        }
+    }
+
+    void post(DebugLog::kind kind, uint16_t address, uint8_t value, uint16_t scanline, uint16_t hclock)
+    {
+        if(!running) {
+            running = true;
+            writer = std::thread([this]{ write_loop(); });
+        }
+        debug_record r{kind, value, address, scanline, hclock};
+        while(queue.push(&r, 1) == 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    static void format(const debug_record& r, std::string& text)
+    {
+        using namespace DebugLog;
+        char line[128];
+        switch(r.kind) {
+            case TIA_READ:
+                snprintf(line, sizeof(line), "read from TIA %04X\n", r.address);
+                break;
+            case TIA_WRITE: {
+                auto found = Stella::TIA_register_names.find(r.address);
+                snprintf(line, sizeof(line), "(%3d, %3d) wrote %02X to %02X (%s)\n", r.hclock, r.scanline, r.value, r.address,
+                    (found != Stella::TIA_register_names.end()) ? found->second.c_str() : "?");
+                break;
+            }
+            case PIA_READ:
+                snprintf(line, sizeof(line), "read from PIA %04X\n", r.address);
+                break;
+            case RAM_WRITE:
+                snprintf(line, sizeof(line), "wrote %02X to RAM %04X\n", r.value, r.address);
+                break;
+            case TIMER_TICK:
+                snprintf(line, sizeof(line), "timer now %d\n", r.value);
+                break;
+            case TIMER_READ:
+                snprintf(line, sizeof(line), "read interval timer, %2X\n", r.value);
+                break;
+            case TIMER_STATUS_READ:
+                snprintf(line, sizeof(line), "read interval status, %2X\n", r.value);
+                break;
+        }
+        text += line;
+    }
+
+    void write_loop()
+    {
+        using namespace std::chrono_literals;
+        debug_record records[1024];
+        std::string text;
+        while(true) {
+            // Check before popping so everything posted before shutdown is written
+            bool stopping = !running;
+            size_t count = queue.pop(records, sizeof(records) / sizeof(records[0]));
+            for(size_t i = 0; i < count; i++) {
+                format(records[i], text);
+            }
+            if(!text.empty()) {
+                fwrite(text.data(), 1, text.size(), stdout);
+                text.clear();
+            }
+            if(count == 0) {
+                if(stopping) {
+                    fflush(stdout);
+                    return;
+                }
+                std::this_thread::sleep_for(1ms);
+            }
+        }
+    }
+};
+
+// One logger for the process; exit() stops it after it writes what's queued
+inline debug_logger& debug_log()
+{
+    static debug_logger logger;
+    return logger;
+}
+
+#endif /* DEBUG_LOG_H */
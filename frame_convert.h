@@ -0,0 +1,110 @@
+/*
+    Conversion of COLU-indexed frames to RGB and grayscale
+
+    Emulation produces one COLU byte per pixel, a quarter of the size
+    of 32-bit RGB, and everything downstream gets frames in that form.
+    Converting is a separate step that a consumer runs only if it wants
+    color or gray pixels, e.g. presentation or a video capture format.
+
+    Every output is a lookup into one of the tables palette.h builds at
+    compile time, indexed by COLU >> 1.  Gray, the one byte-to-byte
+    conversion, runs 16 pixels at a time with SSSE3 (eight 16-byte
+    PSHUFB lookups) or AArch64 NEON (two 64-byte TBLs).  Color is a
+    load of a packed table entry per pixel, which measured faster than
+    assembling the channels from vector lookups on x86.
+*/
+
+#ifndef FRAME_CONVERT_H
+#define FRAME_CONVERT_H
+
+#include <cstddef>
+#include <cinttypes>
+
+#include "palette.h"
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+struct frame_converter
+{
+    const Palette::tables *palette = &Palette::NTSC_tables;
+
+    void set_palette(const Palette::tables& tables)
+    {
+        palette = &tables;
+    }
+
+    void to_gray(const uint8_t *colu, size_t count, uint8_t *out) const
+    {
+        size_t i = 0;
+#if defined(__SSSE3__)
+        // PSHUFB returns 0 for an index with bit 7 set, so each 16-entry
+        // slice only contributes the pixels whose index falls inside it
+        __m128i slices[8];
+        for(int slice = 0; slice < 8; slice++) {
+            slices[slice] = _mm_load_si128(reinterpret_cast<const __m128i*>(palette->luma + slice * 16));
+        }
+        for(; i + 16 <= count; i += 16) {
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(colu + i));
+            __m128i index = _mm_and_si128(_mm_srli_epi16(c, 1), _mm_set1_epi8(0x7F));
+            __m128i result = _mm_setzero_si128();
+            for(int slice = 0; slice < 8; slice++) {
+                __m128i local = _mm_adds_epu8(_mm_xor_si128(index, _mm_set1_epi8(slice << 4)), _mm_set1_epi8(0x70));
+                result = _mm_or_si128(result, _mm_shuffle_epi8(slices[slice], local));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), result);
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        // TBL returns 0 for an index past its 64 entries, TBX leaves those alone
+        uint8x16x4_t low = vld1q_u8_x4(palette->luma);
+        uint8x16x4_t high = vld1q_u8_x4(palette->luma + 64);
+        for(; i + 16 <= count; i += 16) {
+            uint8x16_t index = vshrq_n_u8(vld1q_u8(colu + i), 1);
+            uint8x16_t result = vqtbl4q_u8(low, index);
+            vst1q_u8(out + i, vqtbx4q_u8(result, high, vsubq_u8(index, vdupq_n_u8(64))));
+        }
+#endif
+        for(; i < count; i++) {
+            out[i] = palette->luma[colu[i] >> 1];
+        }
+    }
+
+    // Bytes R, G, B per pixel
+    void to_rgb24(const uint8_t *colu, size_t count, uint8_t *out) const
+    {
+        for(size_t i = 0; i < count; i++) {
+            const Palette::rgb& c = palette->colors[colu[i] >> 1];
+            out[i * 3 + 0] = c.r;
+            out[i * 3 + 1] = c.g;
+            out[i * 3 + 2] = c.b;
+        }
+    }
+
+    // Packed 0xAARRGGBB, SDL's ARGB8888
+    void to_argb8888(const uint8_t *colu, size_t count, uint32_t *out) const
+    {
+        for(size_t i = 0; i < count; i++) {
+            out[i] = palette->argb8888[colu[i] >> 1];
+        }
+    }
+
+    // Packed 0xRRGGBBAA
+    void to_rgba8888(const uint8_t *colu, size_t count, uint32_t *out) const
+    {
+        for(size_t i = 0; i < count; i++) {
+            out[i] = palette->rgba8888[colu[i] >> 1];
+        }
+    }
+
+    void to_rgb565(const uint8_t *colu, size_t count, uint16_t *out) const
+    {
+        for(size_t i = 0; i < count; i++) {
+            out[i] = palette->rgb565[colu[i] >> 1];
+        }
+    }
+};
+
+#endif /* FRAME_CONVERT_H */
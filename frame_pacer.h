@@ -0,0 +1,119 @@
+/*
+    Frame pacing on the monotonic clock
+
+    PACE_CLOCK sleeps until each frame's deadline, deadlines being
+    exactly one period apart so rounding never accumulates.
+    PACE_AUDIO waits until the audio device has consumed enough queued
+    audio, so emulation runs at exactly the rate the sound card plays.
+    PACE_DISPLAY doesn't wait at all and leaves pacing to a vsync'd
+    present.  PACE_NONE doesn't wait either, and runs as fast as the
+    host allows.
+
+    Every mode keeps running statistics of frame-to-frame intervals.
+*/
+
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <thread>
+
+struct frame_pacer
+{
+    enum mode {
+        PACE_CLOCK,
+        PACE_AUDIO,
+        PACE_DISPLAY,
+        PACE_NONE,
+    };
+
+    static constexpr double NTSC_frame_rate = 60000.0 / 1001.0;
+    static constexpr double PAL_frame_rate = 50.0;
+
+    typedef std::chrono::steady_clock clock;
+
+    mode pacing = PACE_AUDIO;
+    clock::duration period = std::chrono::nanoseconds(16683333);
+    clock::time_point deadline;
+    clock::time_point previous_frame;
+    bool started = false;
+
+    // Welford's running mean and variance of frame intervals, in seconds
+    uint64_t intervals = 0;
+    double interval_mean = 0;
+    double interval_m2 = 0;
+    double interval_min = 1e9;
+    double interval_max = 0;
+
+    void set_frame_rate(double hz)
+    {
+        period = std::chrono::nanoseconds((int64_t)llround(1e9 / hz));
+    }
+
+    // audio_is_ahead is polled in PACE_AUDIO and should return true while
+    // more audio than the target latency is still queued
+    void wait(const std::function<bool()>& audio_is_ahead)
+    {
+        using namespace std::chrono_literals;
+
+        clock::time_point now = clock::now();
+        if(!started) {
+            started = true;
+            deadline = now + period;
+            previous_frame = now;
+            return;
+        }
+
+        switch(pacing) {
+            case PACE_CLOCK:
+                if(now > deadline + 2 * period) {
+                    // Fell far behind, e.g. window was dragged; don't try to catch up
+                    deadline = now;
+                }
+                std::this_thread::sleep_until(deadline);
+                deadline += period;
+                break;
+            case PACE_AUDIO:
+                while(audio_is_ahead()) {
+                    std::this_thread::sleep_for(500us);
+                }
+                break;
+            case PACE_DISPLAY:
+            case PACE_NONE:
+                break;
+        }
+
+        now = clock::now();
+        record_interval(std::chrono::duration<double>(now - previous_frame).count());
+        previous_frame = now;
+    }
+
+    void record_interval(double seconds)
+    {
+        intervals++;
+        double delta = seconds - interval_mean;
+        interval_mean += delta / intervals;
+        interval_m2 += delta * (seconds - interval_mean);
+        interval_min = std::min(interval_min, seconds);
+        interval_max = std::max(interval_max, seconds);
+    }
+
+    double interval_stddev() const
+    {
+        return (intervals > 1) ? sqrt(interval_m2 / (intervals - 1)) : 0.0;
+    }
+
+    void reset_statistics()
+    {
+        intervals = 0;
+        interval_mean = 0;
+        interval_m2 = 0;
+        interval_min = 1e9;
+        interval_max = 0;
+    }
+};
+
+#endif /* FRAME_PACER_H */
@@ -1,10 +1,14 @@
 #include <vector>
 #include <array>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <thread>
 #include <iostream>
 #include <cstdint>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
 #include <SDL2/SDL.h>
 
 #define EMULATE_65C02 0
@@ -12,6 +16,19 @@
 #include "dis6502.h"
 
 #include "stella.h"
+#include "supercharger.h"
+#include "tia_audio.h"
+#include "audio_trace.h"
+#include "register_capture.h"
+#include "debug_log.h"
+#include "movie.h"
+#include "video_capture.h"
+#include "wav_writer.h"
+#include "scaler.h"
+#include "ring_buffer.h"
+#include "frame_pacer.h"
+#include "triple_buffer.h"
+#include "trace_event.h"
 
 // 1 key toggles TV Type, starts as Color
 // 2 key momentaries Reset
@@ -28,363 +45,195 @@
 namespace PlatformInterface
 {
 
-uint8_t colu_to_rgb[256][3] = {
-    {0x00, 0x00, 0x00},
-    {0x00, 0x00, 0x00},
-    {0x40, 0x40, 0x40},
-    {0x40, 0x40, 0x40},
-    {0x6C, 0x6C, 0x6C},
-    {0x6C, 0x6C, 0x6C},
-    {0x90, 0x90, 0x90},
-    {0x90, 0x90, 0x90},
-    {0xB0, 0xB0, 0xB0},
-    {0xB0, 0xB0, 0xB0},
-    {0xC8, 0xC8, 0xC8},
-    {0xC8, 0xC8, 0xC8},
-    {0xDC, 0xDC, 0xDC},
-    {0xDC, 0xDC, 0xDC},
-    {0xEC, 0xEC, 0xEC},
-    {0xEC, 0xEC, 0xEC},
-    {0x44, 0x44, 0x00},
-    {0x44, 0x44, 0x00},
-    {0x64, 0x64, 0x10},
-    {0x64, 0x64, 0x10},
-    {0x84, 0x84, 0x24},
-    {0x84, 0x84, 0x24},
-    {0xA0, 0xA0, 0x34},
-    {0xA0, 0xA0, 0x34},
-    {0xB8, 0xB8, 0x40},
-    {0xB8, 0xB8, 0x40},
-    {0xD0, 0xD0, 0x50},
-    {0xD0, 0xD0, 0x50},
-    {0xE8, 0xE8, 0x5C},
-    {0xE8, 0xE8, 0x5C},
-    {0xFC, 0xFC, 0x68},
-    {0xFC, 0xFC, 0x68},
-    {0x70, 0x28, 0x00},
-    {0x70, 0x28, 0x00},
-    {0x84, 0x44, 0x14},
-    {0x84, 0x44, 0x14},
-    {0x98, 0x5C, 0x28},
-    {0x98, 0x5C, 0x28},
-    {0xAC, 0x78, 0x3C},
-    {0xAC, 0x78, 0x3C},
-    {0xBC, 0x8C, 0x4C},
-    {0xBC, 0x8C, 0x4C},
-    {0xCC, 0xA0, 0x5C},
-    {0xCC, 0xA0, 0x5C},
-    {0xDC, 0xB4, 0x68},
-    {0xDC, 0xB4, 0x68},
-    {0xE8, 0xCC, 0x7C},
-    {0xE8, 0xCC, 0x7C},
-    {0x84, 0x18, 0x00},
-    {0x84, 0x18, 0x00},
-    {0x98, 0x34, 0x18},
-    {0x98, 0x34, 0x18},
-    {0xAC, 0x50, 0x30},
-    {0xAC, 0x50, 0x30},
-    {0xC0, 0x68, 0x48},
-    {0xC0, 0x68, 0x48},
-    {0xD0, 0x80, 0x5C},
-    {0xD0, 0x80, 0x5C},
-    {0xE0, 0x94, 0x70},
-    {0xE0, 0x94, 0x70},
-    {0xEC, 0xA8, 0x80},
-    {0xEC, 0xA8, 0x80},
-    {0xFC, 0xBC, 0x94},
-    {0xFC, 0xBC, 0x94},
-    {0x88, 0x00, 0x00},
-    {0x88, 0x00, 0x00},
-    {0x9C, 0x20, 0x20},
-    {0x9C, 0x20, 0x20},
-    {0xB0, 0x3C, 0x3C},
-    {0xB0, 0x3C, 0x3C},
-    {0xC0, 0x58, 0x58},
-    {0xC0, 0x58, 0x58},
-    {0xD0, 0x70, 0x70},
-    {0xD0, 0x70, 0x70},
-    {0xE0, 0x88, 0x88},
-    {0xE0, 0x88, 0x88},
-    {0xEC, 0xA0, 0xA0},
-    {0xEC, 0xA0, 0xA0},
-    {0xFC, 0xB4, 0xB4},
-    {0xFC, 0xB4, 0xB4},
-    {0x78, 0x00, 0x5C},
-    {0x78, 0x00, 0x5C},
-    {0x8C, 0x20, 0x74},
-    {0x8C, 0x20, 0x74},
-    {0xA0, 0x3C, 0x88},
-    {0xA0, 0x3C, 0x88},
-    {0xB0, 0x58, 0x9C},
-    {0xB0, 0x58, 0x9C},
-    {0xC0, 0x70, 0xB0},
-    {0xC0, 0x70, 0xB0},
-    {0xD0, 0x84, 0xC0},
-    {0xD0, 0x84, 0xC0},
-    {0xDC, 0x9C, 0xD0},
-    {0xDC, 0x9C, 0xD0},
-    {0xEC, 0xB0, 0xE0},
-    {0xEC, 0xB0, 0xE0},
-    {0x48, 0x00, 0x78},
-    {0x48, 0x00, 0x78},
-    {0x60, 0x20, 0x90},
-    {0x60, 0x20, 0x90},
-    {0x78, 0x3C, 0xA4},
-    {0x78, 0x3C, 0xA4},
-    {0x8C, 0x58, 0xB8},
-    {0x8C, 0x58, 0xB8},
-    {0xA0, 0x70, 0xCC},
-    {0xA0, 0x70, 0xCC},
-    {0xB4, 0x84, 0xDC},
-    {0xB4, 0x84, 0xDC},
-    {0xC4, 0x9C, 0xEC},
-    {0xC4, 0x9C, 0xEC},
-    {0xD4, 0xB0, 0xFC},
-    {0xD4, 0xB0, 0xFC},
-    {0x14, 0x00, 0x84},
-    {0x14, 0x00, 0x84},
-    {0x30, 0x20, 0x98},
-    {0x30, 0x20, 0x98},
-    {0x4C, 0x3C, 0xAC},
-    {0x4C, 0x3C, 0xAC},
-    {0x68, 0x58, 0xC0},
-    {0x68, 0x58, 0xC0},
-    {0x7C, 0x70, 0xD0},
-    {0x7C, 0x70, 0xD0},
-    {0x94, 0x88, 0xE0},
-    {0x94, 0x88, 0xE0},
-    {0xA8, 0xA0, 0xEC},
-    {0xA8, 0xA0, 0xEC},
-    {0xBC, 0xB4, 0xFC},
-    {0xBC, 0xB4, 0xFC},
-    {0x00, 0x00, 0x88},
-    {0x00, 0x00, 0x88},
-    {0x1C, 0x20, 0x9C},
-    {0x1C, 0x20, 0x9C},
-    {0x38, 0x40, 0xB0},
-    {0x38, 0x40, 0xB0},
-    {0x50, 0x5C, 0xC0},
-    {0x50, 0x5C, 0xC0},
-    {0x68, 0x74, 0xD0},
-    {0x68, 0x74, 0xD0},
-    {0x7C, 0x8C, 0xE0},
-    {0x7C, 0x8C, 0xE0},
-    {0x90, 0xA4, 0xEC},
-    {0x90, 0xA4, 0xEC},
-    {0xA4, 0xB8, 0xFC},
-    {0xA4, 0xB8, 0xFC},
-    {0x00, 0x18, 0x7C},
-    {0x00, 0x18, 0x7C},
-    {0x1C, 0x38, 0x90},
-    {0x1C, 0x38, 0x90},
-    {0x38, 0x54, 0xA8},
-    {0x38, 0x54, 0xA8},
-    {0x50, 0x70, 0xBC},
-    {0x50, 0x70, 0xBC},
-    {0x68, 0x88, 0xCC},
-    {0x68, 0x88, 0xCC},
-    {0x7C, 0x9C, 0xDC},
-    {0x7C, 0x9C, 0xDC},
-    {0x90, 0xB4, 0xEC},
-    {0x90, 0xB4, 0xEC},
-    {0xA4, 0xC8, 0xFC},
-    {0xA4, 0xC8, 0xFC},
-    {0x00, 0x2C, 0x5C},
-    {0x00, 0x2C, 0x5C},
-    {0x1C, 0x4C, 0x78},
-    {0x1C, 0x4C, 0x78},
-    {0x38, 0x68, 0x90},
-    {0x38, 0x68, 0x90},
-    {0x50, 0x84, 0xAC},
-    {0x50, 0x84, 0xAC},
-    {0x68, 0x9C, 0xC0},
-    {0x68, 0x9C, 0xC0},
-    {0x7C, 0xB4, 0xD4},
-    {0x7C, 0xB4, 0xD4},
-    {0x90, 0xCC, 0xE8},
-    {0x90, 0xCC, 0xE8},
-    {0xA4, 0xE0, 0xFC},
-    {0xA4, 0xE0, 0xFC},
-    {0x00, 0x40, 0x2C},
-    {0x00, 0x40, 0x2C},
-    {0x1C, 0x5C, 0x48},
-    {0x1C, 0x5C, 0x48},
-    {0x38, 0x7C, 0x64},
-    {0x38, 0x7C, 0x64},
-    {0x50, 0x9C, 0x80},
-    {0x50, 0x9C, 0x80},
-    {0x68, 0xB4, 0x94},
-    {0x68, 0xB4, 0x94},
-    {0x7C, 0xD0, 0xAC},
-    {0x7C, 0xD0, 0xAC},
-    {0x90, 0xE4, 0xC0},
-    {0x90, 0xE4, 0xC0},
-    {0xA4, 0xFC, 0xD4},
-    {0xA4, 0xFC, 0xD4},
-    {0x00, 0x3C, 0x00},
-    {0x00, 0x3C, 0x00},
-    {0x20, 0x5C, 0x20},
-    {0x20, 0x5C, 0x20},
-    {0x40, 0x7C, 0x40},
-    {0x40, 0x7C, 0x40},
-    {0x5C, 0x9C, 0x5C},
-    {0x5C, 0x9C, 0x5C},
-    {0x74, 0xB4, 0x74},
-    {0x74, 0xB4, 0x74},
-    {0x8C, 0xD0, 0x8C},
-    {0x8C, 0xD0, 0x8C},
-    {0xA4, 0xE4, 0xA4},
-    {0xA4, 0xE4, 0xA4},
-    {0xB8, 0xFC, 0xB8},
-    {0xB8, 0xFC, 0xB8},
-    {0x14, 0x38, 0x00},
-    {0x14, 0x38, 0x00},
-    {0x34, 0x5C, 0x1C},
-    {0x34, 0x5C, 0x1C},
-    {0x50, 0x7C, 0x38},
-    {0x50, 0x7C, 0x38},
-    {0x6C, 0x98, 0x50},
-    {0x6C, 0x98, 0x50},
-    {0x84, 0xB4, 0x68},
-    {0x84, 0xB4, 0x68},
-    {0x9C, 0xCC, 0x7C},
-    {0x9C, 0xCC, 0x7C},
-    {0xB4, 0xE4, 0x90},
-    {0xB4, 0xE4, 0x90},
-    {0xC8, 0xFC, 0xA4},
-    {0xC8, 0xFC, 0xA4},
-    {0x2C, 0x30, 0x00},
-    {0x2C, 0x30, 0x00},
-    {0x4C, 0x50, 0x1C},
-    {0x4C, 0x50, 0x1C},
-    {0x68, 0x70, 0x34},
-    {0x68, 0x70, 0x34},
-    {0x84, 0x8C, 0x4C},
-    {0x84, 0x8C, 0x4C},
-    {0x9C, 0xA8, 0x64},
-    {0x9C, 0xA8, 0x64},
-    {0xB4, 0xC0, 0x78},
-    {0xB4, 0xC0, 0x78},
-    {0xCC, 0xD4, 0x88},
-    {0xCC, 0xD4, 0x88},
-    {0xE0, 0xEC, 0x9C},
-    {0xE0, 0xEC, 0x9C},
-    {0x44, 0x28, 0x00},
-    {0x44, 0x28, 0x00},
-    {0x64, 0x48, 0x18},
-    {0x64, 0x48, 0x18},
-    {0x84, 0x68, 0x30},
-    {0x84, 0x68, 0x30},
-    {0xA0, 0x84, 0x44},
-    {0xA0, 0x84, 0x44},
-    {0xB8, 0x9C, 0x58},
-    {0xB8, 0x9C, 0x58},
-    {0xD0, 0xB4, 0x6C},
-    {0xD0, 0xB4, 0x6C},
-    {0xE8, 0xCC, 0x7C},
-    {0xE8, 0xCC, 0x7C},
-    {0xFC, 0xE0, 0x8C},
-    {0xFC, 0xE0, 0x8C},
-};
-
-void create_colormap()
-{
-    // generated table from an image
-    // may one day convert color and luminance to rgb with math
-}
-
-static constexpr int SCREEN_SCALE = 2;
-
-uint8_t SWCHB_value =
+// Input is set by events on the presentation thread and read by emulation
+std::atomic<uint8_t> SWCHB_value =
     Stella::SWCHB_RESET_SWITCH | 
     Stella::SWCHB_SELECT_SWITCH | 
     Stella::SWCHB_TVTYPE_SWITCH;
 
-uint8_t ReadConsoleSwitches()
-{
-    return SWCHB_value;
-}
-
-uint16_t paddleValue;
-
-uint16_t RoGetPaddleValue(int paddle)
-{
-    if(paddle == 0)
-    {
-        return paddleValue;
-    }
-    else
-    {
-        return 0;
-    }
-}
+// Pot positions, 0 for least resistance; the mouse drives paddle 0
+// and joysticks drive paddles 1 through 3 with their first two axes,
+// in the order they were plugged in
+std::atomic<uint16_t> paddle_values[4];
+std::vector<SDL_JoystickID> paddle_joysticks;
 
 // SWCHA and then player0button and player1button
 // The joystick values are set when not pressed
-uint8_t SWCHA_value =
+std::atomic<uint8_t> SWCHA_value =
     Stella::SWCHA_JOYSTICK0_UP | Stella::SWCHA_JOYSTICK0_DOWN | Stella::SWCHA_JOYSTICK0_LEFT | Stella::SWCHA_JOYSTICK0_RIGHT |
     Stella::SWCHA_JOYSTICK1_UP | Stella::SWCHA_JOYSTICK1_DOWN | Stella::SWCHA_JOYSTICK1_LEFT | Stella::SWCHA_JOYSTICK1_RIGHT;
-uint8_t player0button = 0x80; // as shows up in INPT4, 0x00 if pressed, 0x80 if not pressed.
-uint8_t player1button = 0x80; // as shows up in INPT5, 0x00 if pressed, 0x80 if not pressed.
-std::tuple<uint8_t, uint8_t, uint8_t> ReadJoysticks()
+std::atomic<uint8_t> player0button = 0x80; // as shows up in INPT4, 0x00 if pressed, 0x80 if not pressed.
+std::atomic<uint8_t> player1button = 0x80; // as shows up in INPT5, 0x00 if pressed, 0x80 if not pressed.
+
+// With --latency, when the oldest input event not yet latched by
+// emulation arrived, in steady_clock nanoseconds, or 0 if none
+bool measure_latency = false;
+std::atomic<int64_t> unlatched_input_time{0};
+
+int64_t NowNanoseconds()
 {
-    return std::make_tuple(SWCHA_value, player0button, player1button);
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
+// Everything the console reads from controllers and switches, as the
+// bus sees it for one frame
+struct input_state
+{
+    uint8_t SWCHA;
+    uint8_t SWCHB;
+    uint8_t INPT4;
+    uint8_t INPT5;
+    uint16_t paddles[4];
+};
+
 SDL_AudioDeviceID audio_device;
-bool audio_needs_start = true;
 SDL_AudioFormat actual_audio_format;
 
-void EnqueueStereoU8AudioSamples(uint8_t *buf, size_t sz)
+// Samples flow from emulation through this ring to the SDL audio
+// callback.  The emulator's output rate is nudged up or down by at most
+// max_rate_adjustment to keep the ring near target_audio_fill, which
+// keeps latency low without underruns or the ring overflowing.
+spsc_ring_buffer<uint8_t, 8192> audio_ring;
+size_t target_audio_fill; // bytes
+static constexpr double max_rate_adjustment = 0.005;
+uint8_t last_audio_frame[2] = {128, 128};
+
+void AudioCallback([[maybe_unused]] void *userdata, Uint8 *stream, int len)
 {
-    if(audio_needs_start) {
-        audio_needs_start = false;
-        SDL_PauseAudioDevice(audio_device, 0);
-        /* give a little data to avoid gaps and to avoid a pop */
-        std::array<uint8_t, 256> lead_in;
-        size_t sampleCount = lead_in.size() / 2;
-        for(int i = 0; i < sampleCount; i++) {
-            lead_in[i * 2 + 0] = 128 + (buf[0] - 128) * i / sampleCount;
-            lead_in[i * 2 + 1] = 128 + (buf[0] - 128) * i / sampleCount;
-        }
-        SDL_QueueAudio(audio_device, lead_in.data(), lead_in.size());
+    size_t got = audio_ring.pop(stream, len);
+    if(got >= 2) {
+        last_audio_frame[0] = stream[got - 2];
+        last_audio_frame[1] = stream[got - 1];
     }
+    // Underrun; hold the last level instead of popping back to silence
+    for(size_t i = got; i + 1 < (size_t)len; i += 2) {
+        stream[i + 0] = last_audio_frame[0];
+        stream[i + 1] = last_audio_frame[1];
+    }
+}
 
+void EnqueueStereoU8AudioSamples(uint8_t *buf, size_t sz)
+{
     if(actual_audio_format == AUDIO_U8) {
-        SDL_QueueAudio(audio_device, buf, sz);
+        audio_ring.push(buf, sz & ~(size_t)1);
     }
 }
 
+frame_pacer pacer;
+
+// With --stats, frame interval statistics and the cost of --run-ahead
+// go to stderr every stats_interval frames
+bool print_stats = false;
+static constexpr uint64_t stats_interval = 600;
+
+// With --headless there's no window or audio device; frames and audio
+// only go to files
+bool headless = false;
+
+// Ratio to apply to the nominal output sample rate
+double GetAudioRateRatio()
+{
+    if((pacer.pacing == frame_pacer::PACE_AUDIO) || headless) {
+        // Emulation is already locked to the audio device, or there isn't one
+        return 1.0;
+    }
+    double fill = audio_ring.size();
+    double error = (target_audio_fill - fill) / target_audio_fill;
+    error = std::clamp(error, -1.0, 1.0);
+    return 1.0 + max_rate_adjustment * error;
+}
 
 SDL_Window *window;
 SDL_Renderer *renderer;
-SDL_Surface *surface;
+SDL_Texture *texture;
+Stella::standard palette_standard = Stella::NTSC;
+integer_scaler scaler; // --scale and --scanlines
+// The part of each frame shown, the TV standard's picture unless
+// --full-frame asks for blanking too
+bool show_full_frame = false;
+Stella::frame_area display_area = Stella::NTSC_timing::visible_area;
+
+// Emulation publishes each finished frame here and presentation, on
+// the main thread since SDL wants rendering and events there, shows
+// the newest; neither waits on the other except in PACE_DISPLAY.
+struct frame
+{
+    // COLU values, one per TIA clock; see frame_convert.h for RGB or gray
+    std::array<uint8_t, Stella::clocks_per_line * Stella::max_lines_per_frame> pixels;
+    int64_t input_time = 0; // with --latency, arrival of input first latched in this frame
+};
+triple_buffer<frame> frames;
+std::atomic<uint64_t> frames_published{0};
+std::atomic<uint64_t> frames_presented{0};
+std::atomic<bool> quit_requested{false};
 
-std::chrono::time_point<std::chrono::system_clock> previous_event_time;
-std::chrono::time_point<std::chrono::system_clock> previous_frame_time;
+// Called by emulation once per frame
+input_state LatchInput()
+{
+    input_state input;
+    input.SWCHA = SWCHA_value;
+    input.SWCHB = SWCHB_value;
+    input.INPT4 = player0button;
+    input.INPT5 = player1button;
+    for(int paddle = 0; paddle < 4; paddle++) {
+        input.paddles[paddle] = paddle_values[paddle];
+    }
+    if(measure_latency) {
+        int64_t input_time = unlatched_input_time.exchange(0);
+        if(input_time != 0) {
+            frames.back().input_time = input_time;
+        }
+    }
+    return input;
+}
 
-void Start(uint32_t& stereoU8SampleRate, size_t& preferredAudioBufferSizeBytes)
+void Start(uint32_t lines_per_frame, const Stella::frame_area& visible_area, double frame_rate, uint32_t& stereoU8SampleRate, size_t& preferredAudioBufferSizeBytes)
 {
-    create_colormap();
+    scaler.set_palette(Palette::get(palette_standard));
+    display_area = show_full_frame ? Stella::frame_area{0, 0, Stella::clocks_per_line, lines_per_frame} : visible_area;
+    pacer.set_frame_rate(frame_rate);
+
+    if(headless) {
+        stereoU8SampleRate = 44100;
+        preferredAudioBufferSizeBytes = 128;
+        return;
+    }
 
     if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_JOYSTICK | SDL_INIT_EVENTS) != 0) {
         SDL_Log("Unable to initialize SDL: %s", SDL_GetError());
         exit(1);
     }
 
-    window = SDL_CreateWindow("Atari 2600", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 228 * 2 * SCREEN_SCALE, 262 * SCREEN_SCALE, SDL_WINDOW_RESIZABLE);
+    window = SDL_CreateWindow("Atari 2600", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, display_area.width * 2 * scaler.factor, display_area.height * scaler.factor, SDL_WINDOW_RESIZABLE);
     if(!window) {
         printf("could not open window\n");
         exit(1);
     }
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    // Any driver, so machines without a GPU get the software renderer;
+    // only let vsync block presents if it's what paces frames
+    Uint32 renderer_flags = 0;
+    if(pacer.pacing == frame_pacer::PACE_DISPLAY) {
+        renderer_flags |= SDL_RENDERER_PRESENTVSYNC;
+    }
+    renderer = SDL_CreateRenderer(window, -1, renderer_flags);
+    if(!renderer && (renderer_flags != 0)) {
+        // No driver could vsync; pace by the clock instead
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+        if(renderer) {
+            fprintf(stderr, "renderer can't wait for vsync; pacing by the clock\n");
+            pacer.pacing = frame_pacer::PACE_CLOCK;
+        }
+    }
     if(!renderer) {
         printf("could not create renderer\n");
         exit(1);
     }
-    surface = SDL_CreateRGBSurface(0, 228 * 2, 262, 24, 0, 0, 0, 0);
-    if(!surface) {
-        printf("could not create surface\n");
+    // Scaled on the CPU to the window's size, so the renderer only copies
+    // it unless the window is resized
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+        display_area.width * 2 * scaler.factor, display_area.height * scaler.factor);
+    if(!texture) {
+        printf("could not create texture\n");
         exit(1);
     }
 
@@ -392,8 +241,8 @@ void Start(uint32_t& stereoU8SampleRate, size_t& preferredAudioBufferSizeBytes)
     audiospec.freq = 44100;
     audiospec.format = AUDIO_U8;
     audiospec.channels = 2;
-    audiospec.samples = 1024; // audiospec.freq / 100;
-    audiospec.callback = nullptr;
+    audiospec.samples = 256;
+    audiospec.callback = AudioCallback;
     SDL_AudioSpec obtained;
 
     audio_device = SDL_OpenAudioDevice(nullptr, 0, &audiospec, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE); // | SDL_AUDIO_ALLOW_FORMAT_CHANGE);
@@ -412,13 +261,16 @@ void Start(uint32_t& stereoU8SampleRate, size_t& preferredAudioBufferSizeBytes)
     }
 
     stereoU8SampleRate = obtained.freq;
-    preferredAudioBufferSizeBytes = obtained.samples * 2;
+    preferredAudioBufferSizeBytes = 128;
     actual_audio_format = obtained.format;
+    target_audio_fill = obtained.samples * 2 * 2;
+    if(pacer.pacing == frame_pacer::PACE_AUDIO) {
+        // Each frame's audio lands on top of this, so aim lower
+        target_audio_fill = obtained.samples * 2;
+    }
+    SDL_PauseAudioDevice(audio_device, 0);
 
     SDL_PumpEvents();
-
-    previous_event_time = std::chrono::system_clock::now();
-    previous_frame_time = std::chrono::system_clock::now();
 }
 
 static void HandleEvents(void)
@@ -430,13 +282,67 @@ static void HandleEvents(void)
     static bool shift_pressed = false;
     static SDL_Event event;
 
+    Trace::zone zone("events");
     while (SDL_PollEvent(&event)) {
+        if(measure_latency && (event.type == SDL_KEYDOWN) && !event.key.repeat) {
+            int64_t none = 0;
+            unlatched_input_time.compare_exchange_strong(none, NowNanoseconds());
+        }
         switch (event.type) {
             case SDL_MOUSEMOTION:
                 int width, height;
                 SDL_GetWindowSize(window, &width, &height);
-                paddleValue = 65536 * event.motion.x / width;
+                paddle_values[0] = std::clamp(65535 * event.motion.x / width, 0, 65535);
+                break;
+            case SDL_MOUSEBUTTONDOWN:
+                SWCHA_value &= (uint8_t)~SWCHA_PADDLE0_BUTTON;
+                break;
+            case SDL_MOUSEBUTTONUP:
+                SWCHA_value |= SWCHA_PADDLE0_BUTTON;
+                break;
+            case SDL_JOYDEVICEADDED:
+                if(SDL_Joystick *joystick = SDL_JoystickOpen(event.jdevice.which)) {
+                    paddle_joysticks.push_back(SDL_JoystickInstanceID(joystick));
+                }
+                break;
+            case SDL_JOYDEVICEREMOVED: {
+                // Sticks after this one move down a pair of paddles
+                auto found = std::find(paddle_joysticks.begin(), paddle_joysticks.end(), event.jdevice.which);
+                if(found != paddle_joysticks.end()) {
+                    paddle_joysticks.erase(found);
+                    SDL_JoystickClose(SDL_JoystickFromInstanceID(event.jdevice.which));
+                }
                 break;
+            }
+            case SDL_JOYAXISMOTION: {
+                // Only sticks we opened, e.g. not one that failed to open
+                auto found = std::find(paddle_joysticks.begin(), paddle_joysticks.end(), event.jaxis.which);
+                if(found == paddle_joysticks.end()) {
+                    break;
+                }
+                int paddle = 1 + (found - paddle_joysticks.begin()) * 2 + event.jaxis.axis;
+                if((event.jaxis.axis < 2) && (paddle < 4)) {
+                    paddle_values[paddle] = event.jaxis.value + 32768;
+                }
+                break;
+            }
+            case SDL_JOYBUTTONDOWN:
+            case SDL_JOYBUTTONUP: {
+                static constexpr uint8_t paddle_buttons[4] = {SWCHA_PADDLE0_BUTTON, SWCHA_PADDLE1_BUTTON, SWCHA_PADDLE2_BUTTON, SWCHA_PADDLE3_BUTTON};
+                auto found = std::find(paddle_joysticks.begin(), paddle_joysticks.end(), event.jbutton.which);
+                if(found == paddle_joysticks.end()) {
+                    break;
+                }
+                int paddle = 1 + (found - paddle_joysticks.begin()) * 2 + event.jbutton.button;
+                if((event.jbutton.button < 2) && (paddle < 4)) {
+                    if(event.type == SDL_JOYBUTTONDOWN) {
+                        SWCHA_value &= (uint8_t)~paddle_buttons[paddle];
+                    } else {
+                        SWCHA_value |= paddle_buttons[paddle];
+                    }
+                }
+                break;
+            }
             // case SDL_MOUSEWHEELEVENT:
                 // SDL_MouseWheelEvent wheel;              /**< Mouse wheel event data */
                 // break;
@@ -447,7 +353,7 @@ static void HandleEvents(void)
                 break;
             case SDL_QUIT:
                 // event_queue.push_back({QUIT, 0});
-                exit(0);
+                quit_requested = true;
                 break;
 
             case SDL_KEYDOWN:
@@ -457,16 +363,16 @@ static void HandleEvents(void)
                         shift_pressed = true;
                         break;
                     case SDL_SCANCODE_W:
-                        SWCHA_value &= (~Stella::SWCHA_JOYSTICK0_UP);
+                        SWCHA_value &= (uint8_t)~Stella::SWCHA_JOYSTICK0_UP;
                         break;
                     case SDL_SCANCODE_S:
-                        SWCHA_value &= (~Stella::SWCHA_JOYSTICK0_DOWN);
+                        SWCHA_value &= (uint8_t)~Stella::SWCHA_JOYSTICK0_DOWN;
                         break;
                     case SDL_SCANCODE_A:
-                        SWCHA_value &= (~Stella::SWCHA_JOYSTICK0_LEFT);
+                        SWCHA_value &= (uint8_t)~Stella::SWCHA_JOYSTICK0_LEFT;
                         break;
                     case SDL_SCANCODE_D:
-                        SWCHA_value &= (~Stella::SWCHA_JOYSTICK0_RIGHT);
+                        SWCHA_value &= (uint8_t)~Stella::SWCHA_JOYSTICK0_RIGHT;
                         break;
                     case SDL_SCANCODE_SPACE:
                         player0button = (uint8_t)~Stella::INPT4_JOYSTICK0_BUTTON;
@@ -476,21 +382,21 @@ static void HandleEvents(void)
                         if(switch_tv_type) {
                             SWCHB_value |= SWCHB_TVTYPE_SWITCH;
                         } else {
-                            SWCHB_value &= ~SWCHB_TVTYPE_SWITCH;
+                            SWCHB_value &= (uint8_t)~SWCHB_TVTYPE_SWITCH;
                         }
                         break;
                     case SDL_SCANCODE_2:
-                        SWCHB_value &= ~SWCHB_RESET_SWITCH;
+                        SWCHB_value &= (uint8_t)~SWCHB_RESET_SWITCH;
                         break;
                     case SDL_SCANCODE_3:
-                        SWCHB_value &= ~SWCHB_SELECT_SWITCH;
+                        SWCHB_value &= (uint8_t)~SWCHB_SELECT_SWITCH;
                         break;
                     case SDL_SCANCODE_4:
                         switch_p0_difficulty = !switch_p0_difficulty;
                         if(switch_p0_difficulty) {
                             SWCHB_value |= SWCHB_P0_DIFFICULTY_SWITCH;
                         } else {
-                            SWCHB_value &= ~SWCHB_P0_DIFFICULTY_SWITCH;
+                            SWCHB_value &= (uint8_t)~SWCHB_P0_DIFFICULTY_SWITCH;
                         }
                         break;
                     case SDL_SCANCODE_5:
@@ -498,7 +404,7 @@ static void HandleEvents(void)
                         if(switch_p1_difficulty) {
                             SWCHB_value |= SWCHB_P1_DIFFICULTY_SWITCH;
                         } else {
-                            SWCHB_value &= ~SWCHB_P1_DIFFICULTY_SWITCH;
+                            SWCHB_value &= (uint8_t)~SWCHB_P1_DIFFICULTY_SWITCH;
                         }
                         break;
                     default:
@@ -544,94 +450,111 @@ static void HandleEvents(void)
     }
 }
 
-void Frame(const uint8_t* screen, [[maybe_unused]] float megahertz)
+// Buffer for emulation to draw the first frame into
+uint8_t *GetFrameBuffer()
 {
-    using namespace std::chrono_literals;
-
-    std::chrono::time_point<std::chrono::system_clock> now = std::chrono::system_clock::now();
-    std::chrono::duration<float> elapsed;
+    return frames.back().pixels.data();
+}
 
-    elapsed = now - previous_frame_time;
-    // printf("elapsed.count() == %f\n", elapsed.count());
-    static constexpr long long minimum_frame_micros = 15000; // Hand-tuned...
+// "screen" must be the buffer from GetFrameBuffer() or the previous
+// Frame(); returns the buffer to draw the next frame into
+uint8_t *Frame([[maybe_unused]] uint8_t* screen, [[maybe_unused]] float megahertz)
+{
+    using namespace std::chrono_literals;
 
-    while(elapsed < std::chrono::microseconds(minimum_frame_micros)) {
-        std::this_thread::sleep_for(std::chrono::microseconds(minimum_frame_micros) - elapsed); // XXX either skip until .05 or do this sleep
-        elapsed = std::chrono::system_clock::now() - previous_frame_time;
-    }
-    if (SDL_MUSTLOCK(surface)) {
-        SDL_LockSurface(surface);
+    Trace::zone zone("pacing");
+    pacer.wait([]{ return audio_ring.size() > target_audio_fill; });
+    if(print_stats && (pacer.intervals == stats_interval)) {
+        fprintf(stderr, "frame interval mean %.3f ms, stddev %.3f ms, min %.3f ms, max %.3f ms\n",
+            pacer.interval_mean * 1000, pacer.interval_stddev() * 1000, pacer.interval_min * 1000, pacer.interval_max * 1000);
+        pacer.reset_statistics();
     }
 
-    uint8_t* framebuffer = reinterpret_cast<uint8_t*>(surface->pixels);
+    frames.publish();
+    frames_published++;
+    frames.back().input_time = 0;
 
-    for(int y = 0; y < 262; y++) {
-        for(int x = 0; x < 228; x++) {
-            uint8_t *pixel = framebuffer + 3 * (x * 2 + y * 228 * 2);
-            uint8_t *rgb = colu_to_rgb[screen[x + y * 228]];
-            pixel[0] = rgb[2];
-            pixel[1] = rgb[1];
-            pixel[2] = rgb[0];
-            pixel[3] = rgb[2];
-            pixel[4] = rgb[1];
-            pixel[5] = rgb[0];
+    if(pacer.pacing == frame_pacer::PACE_DISPLAY) {
+        // The vsync'd present paces us; stay at most a frame ahead of it
+        while((frames_presented + 1 < frames_published) && !quit_requested) {
+            std::this_thread::sleep_for(500us);
         }
     }
 
-    if (SDL_MUSTLOCK(surface)) {
-        SDL_UnlockSurface(surface);
-    }
+    return frames.back().pixels.data();
+}
 
-    // printf("Draw frame\n");
-    SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
-    if(!texture) {
-        printf("could not create texture\n");
+static void Present(const uint8_t* screen)
+{
+    void *pixels;
+    int pitch;
+    if(SDL_LockTexture(texture, nullptr, &pixels, &pitch) != 0) {
+        printf("could not lock texture\n");
         exit(1);
     }
+    const uint8_t *source = screen + display_area.top * Stella::clocks_per_line + display_area.left;
+    {
+        Trace::zone zone("palette conversion");
+        scaler.scale(source, Stella::clocks_per_line, display_area.width, display_area.height, static_cast<uint8_t*>(pixels), pitch);
+    }
+    {
+        Trace::zone zone("texture upload");
+        SDL_UnlockTexture(texture);
+    }
+
+    Trace::zone zone("render");
     SDL_RenderClear(renderer);
     SDL_RenderCopy(renderer, texture, NULL, NULL);
     SDL_RenderPresent(renderer);
-    SDL_DestroyTexture(texture);
-    previous_frame_time = std::chrono::system_clock::now();
+}
 
-    now = std::chrono::system_clock::now();
-    elapsed = now - previous_event_time;
-    if(elapsed.count() > .03) {
-        HandleEvents();
-        previous_event_time = now;
+// Time from a key press to the present of the first frame that
+// latched it; excludes however long the game takes to respond
+void RecordLatency(int64_t nanoseconds)
+{
+    static int count = 0;
+    static double total = 0, minimum = 1e9, maximum = 0;
+    double ms = nanoseconds / 1e6;
+    count++;
+    total += ms;
+    minimum = std::min(minimum, ms);
+    maximum = std::max(maximum, ms);
+    if(count == 10) {
+        printf("input to present latency mean %.2f ms, min %.2f ms, max %.2f ms\n", total / count, minimum, maximum);
+        count = 0;
+        total = 0;
+        minimum = 1e9;
+        maximum = 0;
     }
-
 }
 
-};
-
-#if 0
-void write_screen()
+// Runs on the main thread until the window is closed
+void PresentFrames()
 {
-    using namespace Stella;
-
-    static int frame_number = 0;
-    static char filename[512];
-
-    sprintf(filename, "image%05d.ppm", frame_number);
-    FILE *screenfile = fopen(filename, "wb");
-    fprintf(screenfile, "P6 %d %d 255\n", clocks_per_line * 2, lines_per_frame);
-    for(int y = 0; y < lines_per_frame; y++) {
-        for(int x = 0; x < clocks_per_line; x++) {
-            uint8_t colu = screen[x + y * clocks_per_line];
-            uint8_t *rgb = colu_to_rgb[colu];
-            fwrite(rgb, 3, 1, screenfile);
-            fwrite(rgb, 3, 1, screenfile);
+    using namespace std::chrono_literals;
+    Trace::name_thread("presentation");
+    if(headless) {
+        while(!quit_requested) {
+            std::this_thread::sleep_for(10ms);
+        }
+        return;
+    }
+    while(!quit_requested) {
+        HandleEvents();
+        if(frames.update()) {
+            Present(frames.front().pixels.data());
+            frames_presented++;
+            if(frames.front().input_time != 0) {
+                RecordLatency(NowNanoseconds() - frames.front().input_time);
+            }
+        } else {
+            // Wakes as soon as there's an event instead of sleeping through it
+            SDL_WaitEventTimeout(nullptr, 1);
         }
     }
-    fclose(screenfile);
-    printf("wrote image %s\n", filename);
-
-    frame_number++;
-
-    memset(screen, 0x4F, visible_pixels * visible_lines);
 }
-#endif
+
+};
 
 typedef uint64_t clk_t;
 
@@ -649,143 +572,6 @@ struct sysclock // When I called this "clock" XCode errored out because I shadow
     }
 };
 
-struct TIAAudioChannel
-{
-    int sound_bit = 0;
-    uint16_t poly4 = 0xff;
-    uint16_t poly5 = 0xff;
-    uint16_t poly9 = 0xff;
-    int tone31Counter = 31;
-    int tone6Counter = 3;
-    int tone6 = 1;
-    int tone2 = 1;
-
-    uint8_t advance_clock(uint8_t AUDV, uint8_t AUDF, uint8_t AUDC, int& counter);
-    uint8_t advance_audio_clock(uint8_t AUDC);
-
-    int currentPoly4()
-    {
-        return poly4 & 0x1;
-    }
-
-    int nextPoly4()
-    {
-        int oldbit = poly4 & 0x1;
-        int newbit = ((poly4 >> 1) ^ oldbit) & 0x1;
-        poly4 = (poly4 >> 1) | (newbit << 3);
-        return oldbit;
-    }
-
-    int nextPoly5()
-    {
-        int oldbit = poly5 & 0x1;
-        int newbit = ((poly5 >> 2) ^ oldbit) & 0x1;
-        poly5 = (poly5 >> 1) | (newbit << 4);
-        return oldbit;
-    }
-
-    int nextPoly9()
-    {
-        int oldbit = poly9 & 0x1;
-        int newbit = ((poly9 >> 4) ^ oldbit) & 0x1;
-        poly9 = (poly9 >> 1) | (newbit << 8);
-        return oldbit;
-    }
-
-    int nextTone2()
-    {
-        int bit = tone2;
-        tone2 = tone2 ^ 0x1;
-        return bit;
-    }
-
-    int currentTone6()
-    {
-        return tone6;
-    }
-
-    int nextTone6()
-    {
-        if(tone6Counter > 0) {
-            tone6Counter--;
-        } else {
-            tone6Counter = 3;
-            tone6 ^= 0x1;
-        }
-        return tone6;
-    }
-
-    int currentTone31()
-    {
-        // change this in nextTone31
-        return (tone31Counter > 13) ? 1 : 0;
-    }
-
-    int nextTone31()
-    {
-        if(tone31Counter > 0) { 
-            tone31Counter--;
-        } else {
-            tone31Counter = 31;
-        }
-        return currentTone31();
-    }
-};
-
-uint8_t TIAAudioChannel::advance_audio_clock(uint8_t AUDC)
-{
-    switch(AUDC & 0xF) {
-        case 0x0: case 0xb: default:
-            return 1;
-            break;
-        case 0x1:
-            return nextPoly4();
-            break;
-        case 0x2:
-            return (currentTone31() != nextTone31()) ? nextPoly4() : currentPoly4();
-            break;
-        case 0x3:
-            return (nextPoly5() == 1) ? nextPoly4() : currentPoly4();
-            break;
-        case 0x4: case 0x5:
-            return nextTone2();
-            break;
-        case 0x6: case 0xa:
-            return nextTone31();
-            break;
-        case 0x7: case 0x9:
-            return nextPoly5();
-            break;
-        case 0x8:
-            return nextPoly9();
-            break;
-        case 0xc: case 0xd:
-            return nextTone6();
-            break;
-        case 0xe:
-            return (currentTone31() != nextTone31()) ? nextTone6() : currentTone6();
-            break;
-        case 0xf:
-            return (nextPoly5() == 1) ? nextTone6() : currentTone6();
-            break;
-    }
-}
-
-uint8_t TIAAudioChannel::advance_clock(uint8_t AUDV, uint8_t AUDF, uint8_t AUDC, int& counter)
-{
-    using namespace Stella;
-
-    // Does writing new AUDF reset the counter?  Or is it only used to reload the counter?
-    if(counter > 0) {
-        counter--;
-    } else {
-        sound_bit = advance_audio_clock(AUDC);
-        counter = AUDF;
-    }
-
-    return 128 + (sound_bit ? -128 : 127 ) * (AUDV & 0xF) / 128;
-}
-
 struct object_counter
 {
     uint8_t counter = 0;
@@ -830,22 +616,30 @@ struct object_counter
     }
 };
 
-struct stella 
+// Timing is one of Stella::NTSC_timing, PAL_timing, or SECAM_timing
+template <class Timing>
+struct stella
 {
     enum {
-        DEBUG_TIA = 0x0001,
-        DEBUG_TIMER = 0x0002,
-        DEBUG_PIA = 0x0004,
-        DEBUG_RAM = 0x0008,
+        DEBUG_TIA = DebugLog::TIA,
+        DEBUG_TIMER = DebugLog::TIMER,
+        DEBUG_PIA = DebugLog::PIA,
+        DEBUG_RAM = DebugLog::RAM,
     };
-    static constexpr uint32_t debug = DEBUG_TIA;
+    static constexpr uint32_t debug = DebugLog::mask; // set with make DEBUG=...
 
     std::array<uint8_t, 128> RAM;
     std::vector<uint8_t> ROM;
     uint16_t ROM_address_mask;
+    bool is_supercharger = false;
+    supercharger AR;
+    uint16_t previous_bus_address = 0;
+    uint64_t distinct_bus_accesses = 0;
     sysclock& clk;
     uint32_t horizontal_clock = 0;
     uint32_t scanline = 0;
+    uint64_t frame = 0;
+    register_capture capture;
     bool within_hblank = true;
     bool late_reset_hblank = false;
     bool hmove_latched = false;
@@ -863,31 +657,90 @@ struct stella
     uint32_t interval_timer = 0;
     bool timer_interrupt = false;
 
-    uint8_t row_buffers[2][Stella::clocks_per_line];
-    uint8_t *previous_row;
+    // Pixels go straight into the caller's frame buffer, a line at a time;
+    // a frame ends at the end of the line where VSYNC ends, or after
+    // Stella::max_lines_per_frame lines if it never does
+    uint8_t *frame_pixels = nullptr;
     uint8_t *current_row;
-
-    int audio_counter[2] = {0, 0};
-    uint64_t next_sample_index = 0;
-    uint8_t audio_levels[2] = {128, 128};
-    clk_t next_sample_clock = 0;
-    uint32_t sampling_rate = 44100;
-    clk_t previous_audio_processing_clock = 0;
-    clk_t next_audio_clock = 0;
-    clk_t clock_rate = 3579540;
-    static constexpr clk_t video_clocks_per_audio_clock = 114;
-    TIAAudioChannel audio_channels[2];
+    uint8_t spill_row[Stella::clocks_per_line]; // the next frame's first clocks, until begin_frame()
+    bool frame_ends_this_line = false;
+    bool frame_finished = false;
+    uint32_t frame_lines = 0; // of the finished frame
+    bool reported_tall_frame = false;
+
+    // While running frames ahead that will be rolled back, audio isn't
+    // run at all and nothing is captured or traced
+    bool speculating = false;
+    bool capture_was_enabled = false;
+
+    clk_t tia_clock = 0;
+    static constexpr clk_t clock_rate = Timing::clock_rate;
+    TIAAudio audio;
+    audio_trace_writer audio_trace;
+    clk_t next_audio_keyframe_clock = 0;
+    TIAAudio wav_audio; // for --wav, at a fixed rate
+    wav_writer wav;
     uint32_t stereoU8SampleRate;
     size_t preferredAudioBufferSizeBytes;
     std::vector<unsigned char> audio_buffer;
 
-    clk_t paddle_discharge_clock[4];
+    PlatformInterface::input_state input;
+    bool input_latched = false;
+
+    // When VBLANK last stopped dumping the paddle capacitors
+    clk_t paddle_charge_clock = 0;
+    // Charge time is linear in pot resistance; see paddle_value_bit()
+    double paddle_charge_clocks_base;
+    double paddle_charge_clocks_per_unit;
+
+    movie_writer movie_out;
+    movie_reader movie_in;
+    bool playing_movie = false;
+    bool keyframe_pending = false; // for movie_out, at the next instruction boundary
+
+    // Once per frame, from the movie if one is playing
+    void latch_input()
+    {
+        input_latched = true;
+        if(playing_movie) {
+            movie_input m;
+            if(movie_in.input(frame, m)) {
+                input.SWCHA = m.SWCHA;
+                input.SWCHB = m.SWCHB;
+                input.INPT4 = m.INPT4;
+                input.INPT5 = m.INPT5;
+                memcpy(input.paddles, m.paddles, sizeof(input.paddles));
+                return;
+            }
+            if(!speculating) {
+                printf("movie ended at frame %llu, continuing with live input\n", (unsigned long long)frame);
+                playing_movie = false;
+            }
+        }
+        input = PlatformInterface::LatchInput();
+        if(movie_out.file && !speculating) {
+            movie_input m{(uint32_t)frame, input.SWCHA, input.SWCHB, input.INPT4, input.INPT5};
+            memcpy(m.paddles, input.paddles, sizeof(m.paddles));
+            movie_out.write_input(m);
+        }
+    }
+
+    // RC charging reaches the threshold after R * C * ln(1 / (1 - threshold))
+    void set_paddle_timing()
+    {
+        using namespace Stella;
+        double clocks_per_ohm = paddle_capacitance * -std::log(1.0 - paddle_threshold) * clock_rate;
+        paddle_charge_clocks_base = paddle_series_ohms * clocks_per_ohm;
+        paddle_charge_clocks_per_unit = paddle_pot_ohms / 65535 * clocks_per_ohm;
+    }
 
     uint8_t paddle_value_bit(int paddle)
     {
-        bool paddle_discharged = clk > paddle_discharge_clock[paddle];
-        uint8_t paddle_bit = paddle_discharged ? 0x00 : 0x80;
-        return paddle_bit;
+        if(tia_write[Stella::VBLANK] & Stella::VBLANK_DUMP_PADDLES) {
+            return 0x00;
+        }
+        double charge_clocks = paddle_charge_clocks_base + paddle_charge_clocks_per_unit * input.paddles[paddle];
+        return (clk - paddle_charge_clock >= charge_clocks) ? 0x80 : 0x00;
     }
 
     void set_interval_timer(int prescaler, uint8_t value)
@@ -919,36 +772,77 @@ struct stella
                 } else {
                     interval_timer--;
                 }
-                if(debug & DEBUG_TIMER) { printf("timer now %d\n", interval_timer); }
+                if constexpr(debug & DEBUG_TIMER) { debug_log().post(DebugLog::TIMER_TICK, 0, interval_timer, scanline, horizontal_clock); }
             }
         }
     }
 
-    void advance_sound_clock()
+    void write_audio(uint8_t reg, uint8_t data)
     {
-        using namespace Stella;
-        clk_t current_audio_processing_clock = previous_audio_processing_clock + 1;
-
-        // fprintf(stderr, "%llu, %llu, %llu\n", current_audio_processing_clock, next_audio_clock, next_sample_clock);
-
-        if(next_audio_clock < current_audio_processing_clock) {
-            audio_levels[0] = audio_channels[0].advance_clock(tia_write[AUDV0], tia_write[AUDF0], tia_write[AUDC0], audio_counter[0]);
-            audio_levels[1] = audio_channels[1].advance_clock(tia_write[AUDV1], tia_write[AUDF1], tia_write[AUDC1], audio_counter[1]);
-            next_audio_clock = current_audio_processing_clock + video_clocks_per_audio_clock;
+        tia_write[reg] = data;
+        if(speculating) {
+            return;
         }
+        audio.write(reg, data, tia_clock);
+        if(wav.file) {
+            wav_audio.write(reg, data, tia_clock);
+        }
+        if(audio_trace.file) {
+            audio_trace.write(tia_clock, reg, data);
+        }
+    }
 
-        if(next_sample_clock < current_audio_processing_clock) {
-            audio_buffer.push_back(audio_levels[0]);
-            audio_buffer.push_back(audio_levels[1]);
+    // Run the audio channels up to "until" and queue what was resampled
+    void advance_sound_to_clock(clk_t until)
+    {
+        Trace::zone zone("audio");
+        audio.advance_to_clock(until);
+
+        size_t available = audio.samples_available();
+        while(available > 0) {
+            size_t room = (preferredAudioBufferSizeBytes - audio_buffer.size()) / 2;
+            size_t count = std::min(available, room);
+            size_t previous_size = audio_buffer.size();
+            audio_buffer.resize(previous_size + count * 2);
+            audio.read_samples(audio_buffer.data() + previous_size, count);
+            available -= count;
             if(audio_buffer.size() == preferredAudioBufferSizeBytes) {
                 PlatformInterface::EnqueueStereoU8AudioSamples(audio_buffer.data(), audio_buffer.size());
                 audio_buffer.clear();
+                audio.set_sample_rate(stereoU8SampleRate * PlatformInterface::GetAudioRateRatio());
             }
-            next_sample_index ++;
-            next_sample_clock = next_sample_index * clock_rate / sampling_rate;
         }
 
-        previous_audio_processing_clock = current_audio_processing_clock;
+        if(wav.file) {
+            wav_audio.advance_to_clock(until);
+            switch(wav.format) {
+                case WAV::U8: record_audio<uint8_t>(); break;
+                case WAV::S16: record_audio<int16_t>(); break;
+                case WAV::FLOAT: record_audio<float>(); break;
+            }
+        }
+    }
+
+    template <class T>
+    void record_audio()
+    {
+        T samples[256 * 2];
+        size_t available = wav_audio.samples_available();
+        while(available > 0) {
+            size_t count = std::min<size_t>(available, 256);
+            wav_audio.read_samples(samples, count);
+            wav.write(samples, count * 2 * sizeof(T));
+            available -= count;
+        }
+    }
+
+    // Lets trace_to_pcm render the trace in parallel from here
+    void write_audio_keyframe()
+    {
+        uint8_t payload[TIAAudio::keyframe::keyframe_size];
+        audio.save().encode(payload);
+        audio_trace.write_payload(tia_clock, AudioTrace::KEYFRAME, payload, sizeof(payload));
+        next_audio_keyframe_clock = tia_clock + clock_rate;
     }
 
     void advance_object_counters()
@@ -974,21 +868,29 @@ struct stella
         ROM(std::move(ROM)),
         clk(clock)
     {
-        previous_row = row_buffers[1];
-        current_row = row_buffers[0];
+        current_row = spill_row;
         using namespace Stella;
         if(ROM.size() == 0x800) {
             ROM_address_mask = 0x7ff;
         } else if(ROM.size() == 0x1000) {
             ROM_address_mask = 0xfff;
+        } else if((ROM.size() > 0) && (ROM.size() % supercharger::load_size == 0)) {
+            is_supercharger = true;
+            AR.insert(ROM);
         } else {
             std::cout << "dunno about ROM size " << ROM.size() << "\n";
             abort();
         }
-        memset(row_buffers, 0, sizeof(row_buffers));
+        memset(spill_row, 0, sizeof(spill_row));
         tia_write[AUDV0] = 0;
         tia_write[AUDV1] = 0;
-        PlatformInterface::Start(stereoU8SampleRate, preferredAudioBufferSizeBytes);
+        tia_write[VBLANK] = 0;
+        PlatformInterface::Start(Timing::lines_per_frame, Timing::visible_area, Timing::frame_rate, stereoU8SampleRate, preferredAudioBufferSizeBytes);
+        audio.set_rates(clock_rate, stereoU8SampleRate);
+        audio.volume_percent = 25;
+        set_paddle_timing();
+        // Power-on values until frame 0 latches its own
+        input = PlatformInterface::LatchInput();
     }
 
     bool isPIA(uint16_t addr)
@@ -1009,10 +911,96 @@ struct stella
         return (addr & address_mask) == RAM_select_value;
     }
 
+    void count_bus_access(uint16_t addr)
+    {
+        if(addr != previous_bus_address) {
+            distinct_bus_accesses++;
+            previous_bus_address = addr;
+        }
+    }
+
+    // TIA and RIOT, not RAM or cartridge
+    bool is_register(uint16_t addr)
+    {
+        using namespace Stella;
+        return (addr < ROMbase) && !isRAM(addr);
+    }
+
+    void capture_access(uint16_t addr, uint8_t data, uint8_t flags)
+    {
+        if(within_hblank) {
+            flags |= RegisterCapture::HBLANK;
+        }
+        capture.record(tia_clock, frame, scanline, horizontal_clock, addr, data, flags);
+    }
+
+    // "pixels" must hold Stella::max_lines_per_frame lines
+    void begin_frame(uint8_t *pixels)
+    {
+        frame_pixels = pixels;
+        current_row = pixels + scanline * Stella::clocks_per_line;
+        memcpy(current_row, spill_row, horizontal_clock);
+        frame_finished = false;
+    }
+
+    // Lines past a short frame are blanked so consumers can always read
+    // the standard's lines_per_frame.  Display and video capture are a
+    // fixed size, so they show only that many lines of a taller frame;
+    // the first one is reported so the clipping isn't silent
+    void end_frame()
+    {
+        using namespace Stella;
+        frame_lines = scanline;
+        if(scanline < Timing::lines_per_frame) {
+            memset(frame_pixels + scanline * clocks_per_line, 0, (Timing::lines_per_frame - scanline) * clocks_per_line);
+        } else if((scanline > Timing::lines_per_frame) && !speculating && !reported_tall_frame) {
+            fprintf(stderr, "frame %" PRIu64 " has %u lines; display and video show only the first %u\n",
+                frame, scanline, Timing::lines_per_frame);
+            reported_tall_frame = true;
+        }
+        frame_finished = true;
+        frame_ends_this_line = false;
+        scanline = 0;
+        current_row = spill_row;
+        start_frame();
+    }
+
+    void start_frame()
+    {
+        // For games that never end VBLANK
+        if(!input_latched) {
+            latch_input();
+        }
+        input_latched = false;
+        frame++;
+        if(!speculating) {
+            capture.set_frame(frame);
+            keyframe_pending = movie_out.keyframe_due(frame);
+        }
+    }
+
     uint8_t read(uint16_t addr)
+    {
+        count_bus_access(addr);
+        uint8_t data = decode_read(addr);
+        if(capture.enabled && is_register(addr)) {
+            capture_access(addr, data, 0);
+        }
+        return data;
+    }
+
+    uint8_t decode_read(uint16_t addr)
     {
         using namespace Stella;
         if(addr >= ROMbase) {
+            if(is_supercharger) {
+                uint8_t data = AR.access(addr, distinct_bus_accesses, RAM);
+                if(AR.load_failed) {
+                    // The stub would jump to whatever start address RAM holds
+                    PlatformInterface::quit_requested = true;
+                }
+                return data;
+            }
             uint8_t data = ROM.at(addr & ROM_address_mask);
             // printf("read %02X from ROM %04X\n", data, addr);
             return data;
@@ -1021,34 +1009,16 @@ struct stella
             // printf("read %02X from RAM %04X\n", data, addr);
             return data;
         } else if(isTIA(addr)) {
-            if(debug & DEBUG_TIA) { printf("read from TIA %04X\n", addr); }
+            if constexpr(debug & DEBUG_TIA) { debug_log().post(DebugLog::TIA_READ, addr, 0, scanline, horizontal_clock); }
             uint16_t reg = addr & 0xF;
             if(reg == INPT5) {
                 // read latched or unlatched input port 5
-                uint8_t inpt5 = 0;
-                uint8_t swcha, player0button, player1button;
-                std::tie(swcha, player0button, player1button) = PlatformInterface::ReadJoysticks();
-                inpt5 |= player1button;
-                return inpt5;
+                return input.INPT5;
             } else if(reg == INPT4) {
                 // read latched or unlatched input port 4
-                uint8_t inpt4 = 0;
-                uint8_t swcha, player0button, player1button;
-                std::tie(swcha, player0button, player1button) = PlatformInterface::ReadJoysticks();
-                inpt4 |= player0button;
-                return inpt4;
-            } else if(reg == INPT3) {
-                // read latched or unlatched input port 3
-                return paddle_value_bit(reg - INPT0);
-            } else if(reg == INPT2) {
-                // read latched or unlatched input port 2
-                return paddle_value_bit(reg - INPT0);
-            } else if(reg == INPT1) {
-                // read latched or unlatched input port 1
-                return paddle_value_bit(reg - INPT0);
-            } else if(reg == INPT0) {
-                // read latched or unlatched input port 0
-                printf("read INPT0, bit is %d\n", paddle_value_bit(reg - INPT0));
+                return input.INPT4;
+            } else if((reg >= INPT0) && (reg <= INPT3)) {
+                // read paddle capacitor ports 0 through 3
                 return paddle_value_bit(reg - INPT0);
             } else if(reg == CXM0P) {
                 return tia_read[CXM0P];
@@ -1072,24 +1042,22 @@ struct stella
                 return 0x00;
             }
         } else if(isPIA(addr)) {
-            if(debug & DEBUG_PIA) { printf("read from PIA %04X\n", addr); }
+            if constexpr(debug & DEBUG_PIA) { debug_log().post(DebugLog::PIA_READ, addr, 0, scanline, horizontal_clock); }
             addr &= 0x1F;
             if(addr == SWCHB) {
-                return PlatformInterface::ReadConsoleSwitches();
+                return input.SWCHB;
             } else if(addr == INTIM) {
                 uint8_t data = interval_timer;
                 timer_interrupt = false;
-                if(debug & DEBUG_TIMER) { printf("read interval timer, %2X\n", data); }
+                if constexpr(debug & DEBUG_TIMER) { debug_log().post(DebugLog::TIMER_READ, addr, data, scanline, horizontal_clock); }
                 return data;
             } else if(addr == INSTAT) {
                 uint8_t data = timer_interrupt ? 0x80 : 0;
                 timer_interrupt = false;
-                if(debug & DEBUG_TIMER) { printf("read interval status, %2X\n", data); }
+                if constexpr(debug & DEBUG_TIMER) { debug_log().post(DebugLog::TIMER_STATUS_READ, addr, data, scanline, horizontal_clock); }
                 return data;
             } else if(addr == SWCHA) {
-                uint8_t swcha, player0button, player1button;
-                std::tie(swcha, player0button, player1button) = PlatformInterface::ReadJoysticks();
-                return swcha;
+                return input.SWCHA;
             } else {
                 printf("unhandled read from PIA %04X\n", addr);
                 abort();
@@ -1102,9 +1070,15 @@ struct stella
     void write(uint16_t addr, uint8_t data)
     {
         using namespace Stella;
-        if(isRAM(addr)) {
+        count_bus_access(addr);
+        if(capture.enabled && is_register(addr)) {
+            capture_access(addr, data, RegisterCapture::WRITE);
+        }
+        if((addr >= ROMbase) && is_supercharger) {
+            AR.access(addr, distinct_bus_accesses, RAM);
+        } else if(isRAM(addr)) {
             RAM[addr & RAM_address_mask] = data;
-            if(debug & DEBUG_RAM) { printf("wrote %02X to RAM %04X\n", data, addr); }
+            if constexpr(debug & DEBUG_RAM) { debug_log().post(DebugLog::RAM_WRITE, addr, data, scanline, horizontal_clock); }
         } else if(isPIA(addr)) {
             // printf("wrote %02X to PIA %04X\n", data, addr);
             addr &= 0x1F;
@@ -1120,7 +1094,7 @@ struct stella
             // XXX TODO
         } else if(isTIA(addr)) {
             uint8_t reg = addr & 0x3F;
-            if(debug & DEBUG_TIA) { printf("(%3d, %3d) wrote %02X to %02X (%s)\n", horizontal_clock, scanline, data, reg, TIA_register_names[reg].c_str()); }
+            if constexpr(debug & DEBUG_TIA) { debug_log().post(DebugLog::TIA_WRITE, reg, data, scanline, horizontal_clock); }
             if(reg == VSYNC) {
                 if(data & VSYNC_SET) {
                     // printf("VSYNC was enabled at %d, %d\n", horizontal_clock, scanline);
@@ -1128,8 +1102,7 @@ struct stella
                 } else {
                     if(vsync_enabled) {
                         // printf("VSYNC was disabled at %d, %d\n", horizontal_clock, scanline);
-                        scanline = 0;
-                        // write_screen();
+                        frame_ends_this_line = true;
                         vsync_enabled = false;
                     }
                 }
@@ -1208,23 +1181,17 @@ struct stella
                 tia_write[GRP0] = data;
                 // printf("%02X %02X %02X %02X\n", tia_write[GRP0], GRP0A, tia_write[GRP1], GRP1A);
             } else if(reg == AUDV1) {
-                // printf("AUDV1,%llu,%d,%d\n", (clk_t)clk, reg, data);
-                tia_write[AUDV1] = data;
+                write_audio(reg, data);
             } else if(reg == AUDV0) {
-                // printf("AUDV0,%llu,%d,%d\n", (clk_t)clk, reg, data);
-                tia_write[AUDV0] = data;
+                write_audio(reg, data);
             } else if(reg == AUDF1) {
-                // printf("AUDF1,%llu,%d,%d\n", (clk_t)clk, reg, data);
-                tia_write[AUDF1] = data;
+                write_audio(reg, data);
             } else if(reg == AUDF0) {
-                // printf("AUDF0,%llu,%d,%d\n", (clk_t)clk, reg, data);
-                tia_write[AUDF0] = data;
+                write_audio(reg, data);
             } else if(reg == AUDC1) {
-                // printf("AUDC1,%llu,%d,%d\n", (clk_t)clk, reg, data);
-                tia_write[AUDC1] = data;
+                write_audio(reg, data);
             } else if(reg == AUDC0) {
-                // printf("AUDC0,%llu,%d,%d\n", (clk_t)clk, reg, data);
-                tia_write[AUDC0] = data;
+                write_audio(reg, data);
             } else if(reg == RESBL) {
                 // ALMOST DEFINITELY WRONG
                 BLcounter.reset(within_hblank ? 2 : 4);
@@ -1268,16 +1235,14 @@ struct stella
                 // printf("write %d to WSYNC\n", data); 
                 wait_for_hsync = true;
             } else if(reg == VBLANK) {
-                tia_write[VBLANK] = data;
-                if(data & 0x80)
-                {
-                    for(int paddle = 0; paddle < 4; paddle++)
-                    {
-                        clk_t c = clk + PlatformInterface::RoGetPaddleValue(paddle) * 228llu * 240 / 65536;
-                        paddle_discharge_clock[paddle] = c;
-                        // printf("paddle %d discharged at clock %llu, line %llu\n", paddle, c, c / 228);
-                    }
+                if((tia_write[VBLANK] & VBLANK_ENABLED) && !(data & VBLANK_ENABLED) && !input_latched) {
+                    // Picture is about to start; latch input as late as possible
+                    latch_input();
                 }
+                if((tia_write[VBLANK] & VBLANK_DUMP_PADDLES) && !(data & VBLANK_DUMP_PADDLES)) {
+                    paddle_charge_clock = clk;
+                }
+                tia_write[VBLANK] = data;
                 // printf("write %d to VBLANK\n", data); 
             } else if(reg == 0x2D) {
                 // ignore
@@ -1294,14 +1259,14 @@ struct stella
         }
     }
 
+    uint8_t cachedPF0 = 0;
+    uint8_t cachedPF1 = 0;
+    uint8_t cachedPF2 = 0;
+
     int get_playfield_bit(int horizontal_clock)
     {
         using namespace Stella;
 
-        static uint8_t cachedPF0 = 0;
-        static uint8_t cachedPF1 = 0;
-        static uint8_t cachedPF2 = 0;
-
         if((horizontal_clock == hblank_pixels - 1) || (horizontal_clock == hblank_pixels + visible_pixels / 2)) {
             cachedPF0 = tia_write[PF0];
         }
@@ -1593,8 +1558,6 @@ struct stella
 
         advance_interval_timer();
 
-        advance_sound_clock();
-
         int color = evaluate_pixel_color();
 
         if(mark_cpu_wait) {
@@ -1609,15 +1572,23 @@ struct stella
             hmove_counter -= 1;
         }
 
+        tia_clock++;
         horizontal_clock++;
         if(horizontal_clock >= clocks_per_line) {
+            if(!speculating) {
+                advance_sound_to_clock(tia_clock);
+                if(audio_trace.file && (tia_clock >= next_audio_keyframe_clock)) {
+                    write_audio_keyframe();
+                }
+            }
             late_reset_hblank = false;
             hmove_latched = false;
             horizontal_clock = 0;
             scanline++;
-            std::swap(previous_row, current_row);
-            if(scanline >= lines_per_frame) {
-                scanline = 0;
+            if(frame_ends_this_line || (scanline >= max_lines_per_frame)) {
+                end_frame();
+            } else {
+                current_row += clocks_per_line;
             }
         }
 
@@ -1650,9 +1621,139 @@ struct stella
         wait_for_hsync = false;
         return clocks;
     }
+
+    // Everything that emulation changes except audio, which is left
+    // alone while speculating so it never needs rolling back, and the
+    // frame being drawn; restore() is followed by begin_frame()
+    struct snapshot
+    {
+        std::array<uint8_t, 128> RAM;
+        std::array<uint8_t, 4 * supercharger::bank_size> AR_image;
+        uint32_t AR_slot_offset[2];
+        bool AR_write_enabled, AR_write_pending;
+        uint8_t AR_data_hold;
+        uint64_t AR_data_hold_access;
+        uint16_t previous_bus_address;
+        uint64_t distinct_bus_accesses;
+        uint32_t horizontal_clock, scanline;
+        uint64_t frame;
+        bool within_hblank, late_reset_hblank, hmove_latched;
+        int hmove_counter;
+        object_counter P0counter{0}, P1counter{0}, M0counter{0}, M1counter{0}, BLcounter{0};
+        uint32_t interval_timer_subcounter, interval_timer_prescaler, interval_timer_counter, interval_timer;
+        bool timer_interrupt;
+        uint8_t spill_row[Stella::clocks_per_line];
+        bool frame_ends_this_line;
+        clk_t tia_clock;
+        PlatformInterface::input_state input;
+        bool input_latched;
+        clk_t paddle_charge_clock;
+        uint8_t tia_write[64], tia_read[64];
+        uint8_t GRP0A, GRP1A, ENABLA;
+        bool wait_for_hsync, vsync_enabled, mark_cpu_wait;
+        clk_t last_pixel_clocked;
+        uint8_t cachedPF0, cachedPF1, cachedPF2;
+    };
+
+    // One list of fields for both directions so save and restore can't drift apart
+    void transfer_state(snapshot& s, bool saving)
+    {
+        auto field = [saving](auto& mine, auto& saved) {
+            static_assert(sizeof(mine) == sizeof(saved), "snapshot field doesn't match");
+            if(saving) {
+                memcpy(&saved, &mine, sizeof(mine));
+            } else {
+                memcpy(&mine, &saved, sizeof(mine));
+            }
+        };
+        field(RAM, s.RAM);
+        if(is_supercharger) {
+            field(AR.image, s.AR_image);
+            field(AR.slot_offset, s.AR_slot_offset);
+            field(AR.write_enabled, s.AR_write_enabled);
+            field(AR.write_pending, s.AR_write_pending);
+            field(AR.data_hold, s.AR_data_hold);
+            field(AR.data_hold_access, s.AR_data_hold_access);
+        }
+        field(previous_bus_address, s.previous_bus_address);
+        field(distinct_bus_accesses, s.distinct_bus_accesses);
+        field(horizontal_clock, s.horizontal_clock);
+        field(scanline, s.scanline);
+        field(frame, s.frame);
+        field(within_hblank, s.within_hblank);
+        field(late_reset_hblank, s.late_reset_hblank);
+        field(hmove_latched, s.hmove_latched);
+        field(hmove_counter, s.hmove_counter);
+        field(P0counter, s.P0counter);
+        field(P1counter, s.P1counter);
+        field(M0counter, s.M0counter);
+        field(M1counter, s.M1counter);
+        field(BLcounter, s.BLcounter);
+        field(interval_timer_subcounter, s.interval_timer_subcounter);
+        field(interval_timer_prescaler, s.interval_timer_prescaler);
+        field(interval_timer_counter, s.interval_timer_counter);
+        field(interval_timer, s.interval_timer);
+        field(timer_interrupt, s.timer_interrupt);
+        field(spill_row, s.spill_row);
+        field(frame_ends_this_line, s.frame_ends_this_line);
+        field(tia_clock, s.tia_clock);
+        field(input, s.input);
+        field(input_latched, s.input_latched);
+        field(paddle_charge_clock, s.paddle_charge_clock);
+        field(tia_write, s.tia_write);
+        field(tia_read, s.tia_read);
+        field(GRP0A, s.GRP0A);
+        field(GRP1A, s.GRP1A);
+        field(ENABLA, s.ENABLA);
+        field(wait_for_hsync, s.wait_for_hsync);
+        field(vsync_enabled, s.vsync_enabled);
+        field(mark_cpu_wait, s.mark_cpu_wait);
+        field(last_pixel_clocked, s.last_pixel_clocked);
+        field(cachedPF0, s.cachedPF0);
+        field(cachedPF1, s.cachedPF1);
+        field(cachedPF2, s.cachedPF2);
+    }
+
+    void save(snapshot& s)
+    {
+        transfer_state(s, true);
+    }
+
+    void restore(snapshot& s)
+    {
+        transfer_state(s, false);
+    }
+
+    // After jumping to a snapshot, which doesn't include audio
+    // After a seek, audio picks up at the current clock and registers
+    // without rendering the emulated time skipped
+    void resync_audio()
+    {
+        using namespace Stella;
+        for(uint8_t reg: {AUDC0, AUDC1, AUDF0, AUDF1, AUDV0, AUDV1}) {
+            audio.set_register(reg, tia_write[reg]);
+            wav_audio.set_register(reg, tia_write[reg]);
+        }
+        audio.skip_to(tia_clock);
+        wav_audio.skip_to(tia_clock);
+    }
+
+    void begin_speculation()
+    {
+        speculating = true;
+        capture_was_enabled = capture.enabled;
+        capture.enabled = false;
+    }
+
+    void end_speculation()
+    {
+        speculating = false;
+        capture.enabled = capture_was_enabled;
+    }
 };
 
-std::string read_bus_and_disassemble(stella &hw, int pc)
+template <class Timing>
+std::string read_bus_and_disassemble(stella<Timing> &hw, int pc)
 {
     int bytes;
     std::string dis;
@@ -1665,32 +1766,122 @@ std::string read_bus_and_disassemble(stella &hw, int pc)
     return dis;
 }
 
-int main(int argc, char **argv)
+// Instructions by total cycles, most first, from a PROFILE=1 build's CPU6502
+template <class CPU>
+bool write_cpu_profile(const char *filename, const CPU& cpu)
 {
-    if(argc < 2) {
-        fprintf(stderr, "usage: %s cartridge-rom-file\n", argv[0]);
+    FILE *file = fopen(filename, "w");
+    if(file == nullptr) {
+        return false;
+    }
+    std::vector<uint16_t> addresses;
+    uint64_t total_executions = 0;
+    uint64_t total_cycles = 0;
+    for(uint32_t address = 0; address < cpu.profile.size(); address++) {
+        if(cpu.profile[address].executions > 0) {
+            addresses.push_back(address);
+            total_executions += cpu.profile[address].executions;
+            total_cycles += cpu.profile[address].cycles;
+        }
+    }
+    std::stable_sort(addresses.begin(), addresses.end(), [&](uint16_t a, uint16_t b) {
+        return cpu.profile[a].cycles > cpu.profile[b].cycles;
+    });
+
+    fprintf(file, "# %llu instructions, %llu cycles, at %zu addresses\n",
+        (unsigned long long)total_executions, (unsigned long long)total_cycles, addresses.size());
+    fprintf(file, "#  executions       cycles  percent  per exec  extra cycles  instruction\n");
+    for(uint16_t address : addresses) {
+        const auto& entry = cpu.profile[address];
+        int bytes;
+        std::string dis;
+        std::tie(bytes, dis) = disassemble_6502(address, entry.bytes);
+        fprintf(file, "%12llu %12llu  %6.2f%%  %8.2f  %12llu  %s\n",
+            (unsigned long long)entry.executions, (unsigned long long)entry.cycles,
+            100.0 * entry.cycles / total_cycles, (double)entry.cycles / entry.executions,
+            (unsigned long long)entry.extra_cycles, dis.c_str());
+    }
+    fclose(file);
+    return true;
+}
+
+// Everything main() parses from the command line besides the cartridge
+struct emulation_options
+{
+    Stella::standard tv_standard = Stella::NTSC;
+    const char *audio_trace_filename = nullptr;
+    const char *capture_filename = nullptr;
+    unsigned long long capture_first_frame = 0;
+    unsigned long long capture_last_frame = UINT64_MAX;
+    int run_ahead = 0;
+    const char *record_filename = nullptr;
+    const char *play_filename = nullptr;
+    unsigned long long seek_frame = 0;
+    uint32_t keyframe_interval = Movie::default_keyframe_interval;
+    const char *video_filename = nullptr;
+    const char *wav_filename = nullptr;
+    WAV::format wav_format = WAV::S16;
+    uint32_t wav_rate = WAV::default_sample_rate;
+    unsigned long long frame_limit = 0;
+    VideoCapture::format video_format = VideoCapture::Y4M;
+    const char *profile_filename = nullptr;
+    const char *trace_filename = nullptr;
+    unsigned long long trace_first_frame = 0;
+    unsigned long long trace_last_frame = UINT64_MAX;
+};
+
+// Builds the machine for one TV standard and runs it until quit
+template <class Timing>
+void emulate(const std::vector<uint8_t>& ROM, const emulation_options& options)
+{
+    sysclock clk;
+    stella<Timing> hw(ROM, clk);
+
+    if(options.audio_trace_filename && !hw.audio_trace.open(options.audio_trace_filename, hw.clock_rate)) {
+        fprintf(stderr, "couldn't open %s for writing\n", options.audio_trace_filename);
         exit(EXIT_FAILURE);
     }
-    FILE *ROMfile = fopen(argv[1], "rb");
-    if(ROMfile == nullptr) {
-        std::cerr << "couldn't open " << argv[1] << " for reading.\n";
+
+    if(options.capture_filename) {
+        if(!hw.capture.open(options.capture_filename, options.capture_first_frame, options.capture_last_frame)) {
+            fprintf(stderr, "couldn't open %s for writing\n", options.capture_filename);
+            exit(EXIT_FAILURE);
+        }
+        hw.capture.set_frame(hw.frame);
+    }
+
+    if(options.wav_filename) {
+        if(!hw.wav.open(options.wav_filename, options.wav_format, options.wav_rate)) {
+            fprintf(stderr, "couldn't open %s for writing\n", options.wav_filename);
+            exit(EXIT_FAILURE);
+        }
+        hw.wav_audio.set_rates(hw.clock_rate, options.wav_rate);
+        hw.wav_audio.volume_percent = hw.audio.volume_percent;
+    }
+
+    if(options.trace_filename && !Trace::open(options.trace_filename)) {
+        fprintf(stderr, "couldn't open %s for writing\n", options.trace_filename);
         exit(EXIT_FAILURE);
     }
-    fseek(ROMfile, 0, SEEK_END);
-    long length = ftell(ROMfile);
-    fseek(ROMfile, 0, SEEK_SET);
-    std::vector<uint8_t> ROM;
-    ROM.resize(length);
-    fread(ROM.data(), length, 1, ROMfile);
 
-    sysclock clk;
-    stella hw(ROM, clk);
+    video_capture video;
+    if(options.video_filename) {
+        using namespace Stella;
+        // The 160x210 observation area is centered on the picture
+        const frame_area& visible = Timing::visible_area;
+        video.observer.set_area(visible.left, visible.top + visible.height / 2 - observation_builder::source_height / 2);
+        if(!video.open(options.video_filename, options.video_format, clocks_per_line, Timing::lines_per_frame,
+            Palette::get(PlatformInterface::palette_standard), hw.clock_rate, Timing::clocks_per_frame)) {
+            fprintf(stderr, "couldn't open %s for writing\n", options.video_filename);
+            exit(EXIT_FAILURE);
+        }
+    }
 
     struct clock_handler
     {
         sysclock& clk;
-        stella& hw;
-        clock_handler(sysclock& clk, stella& hw) : clk(clk), hw(hw) {}
+        stella<Timing>& hw;
+        clock_handler(sysclock& clk, stella<Timing>& hw) : clk(clk), hw(hw) {}
         void add_cpu_cycles(int n) {
             for(int i = 0; i < n; i++) {
                 clk.add_pixel_cycles(3);
@@ -1702,33 +1893,436 @@ int main(int argc, char **argv)
     CPU6502 cpu(clk_, hw);
     cpu.reset();
 
-    static uint8_t screen[228 * 262];
+    // Draws a frame straight into "screen"; hw.frame_lines has its height
+    auto run_frame = [&](uint8_t *screen) {
+        cpu.profile_paused = hw.speculating; // count real frames only once
+        if(Trace::file) {
+            Trace::recording = (hw.frame >= options.trace_first_frame) && (hw.frame <= options.trace_last_frame);
+        }
+        Trace::zone frame_zone(hw.speculating ? "speculative frame" : "frame");
+        hw.begin_frame(screen);
+        while(!hw.frame_finished && !PlatformInterface::quit_requested) {
+            if(hw.wait_for_hsync) {
+                Trace::zone zone("TIA catch-up");
+                auto cycles = hw.advance_to_hsync(clk);
+                clk.add_pixel_cycles(cycles);
+                continue;
+            }
+            // Instructions up to the next WSYNC, with the TIA clocked alongside
+            Trace::zone zone("CPU");
+            while(!hw.wait_for_hsync && !hw.frame_finished && !PlatformInterface::quit_requested) {
+                if(false) {
+                    std::string dis = read_bus_and_disassemble(hw, cpu.pc);
+                    printf("%10llu %4u %s\n", (clk_t)clk, hw.horizontal_clock, dis.c_str());
+                }
+                cpu.cycle();
+                // printf("clk = %llu\n", (clk_t)clk);
+            }
+        }
+    };
 
-    while(1) {
-        if(false) {
-            std::string dis = read_bus_and_disassemble(hw, cpu.pc);
-            printf("%10llu %4u %s\n", (clk_t)clk, hw.horizontal_clock, dis.c_str());
+    // For run-ahead and movie keyframes
+    struct machine_snapshot
+    {
+        clk_t clock;
+        uint8_t a, x, y, s, p;
+        uint16_t pc;
+        decltype(cpu.exception) exception;
+        typename stella<Timing>::snapshot hw;
+    };
+    static machine_snapshot before_speculation;
+
+    auto save = [&](machine_snapshot& m) {
+        m.clock = clk.clock;
+        m.a = cpu.a; m.x = cpu.x; m.y = cpu.y; m.s = cpu.s; m.p = cpu.p;
+        m.pc = cpu.pc;
+        m.exception = cpu.exception;
+        hw.save(m.hw);
+    };
+
+    auto restore = [&](machine_snapshot& m) {
+        clk.clock = m.clock;
+        cpu.a = m.a; cpu.x = m.x; cpu.y = m.y; cpu.s = m.s; cpu.p = m.p;
+        cpu.pc = m.pc;
+        cpu.exception = m.exception;
+        hw.restore(m.hw);
+    };
+
+    if(options.record_filename) {
+        if(!hw.movie_out.open(options.record_filename, options.keyframe_interval, sizeof(machine_snapshot), Movie::hash(ROM))) {
+            fprintf(stderr, "couldn't open %s for writing\n", options.record_filename);
+            exit(EXIT_FAILURE);
+        }
+        hw.keyframe_pending = true;
+    }
+
+    if(options.play_filename) {
+        if(!hw.movie_in.open(options.play_filename)) {
+            fprintf(stderr, "couldn't read movie %s\n", options.play_filename);
+            exit(EXIT_FAILURE);
         }
-        auto previous_horizontal_clock = hw.horizontal_clock;
-        auto previous_line = hw.scanline;
-        cpu.cycle();
-        if(hw.scanline != previous_line) {
-            memcpy(screen + Stella::clocks_per_line * previous_line, hw.previous_row, Stella::clocks_per_line);
-            if(hw.scanline == 0) {
-                PlatformInterface::Frame(screen, 1.0f);
+        if((hw.movie_in.keyframe_size != sizeof(machine_snapshot)) || (hw.movie_in.ROM_hash != Movie::hash(ROM))) {
+            fprintf(stderr, "movie %s was recorded from another cartridge or another build\n", options.play_filename);
+            exit(EXIT_FAILURE);
+        }
+        hw.playing_movie = true;
+    }
+
+    // Emulation runs on its own thread so presents never stall it
+    std::thread emulation([&]() {
+        typedef std::chrono::steady_clock timer;
+        Trace::name_thread("emulation");
+        uint8_t *screen = PlatformInterface::GetFrameBuffer();
+        static uint8_t unseen[Stella::clocks_per_line * Stella::max_lines_per_frame];
+        static machine_snapshot keyframe;
+        timer::duration real_time{0}, ahead_time{0};
+        uint64_t timed_frames = 0;
+
+        if(hw.playing_movie) {
+            // Jump to the last keyframe at or before the frame and run silently from there
+            auto start = timer::now();
+            uint64_t keyframe_frame;
+            const uint8_t *stored = hw.movie_in.keyframe_before(options.seek_frame, keyframe_frame);
+            if(stored == nullptr) {
+                fprintf(stderr, "movie doesn't reach frame %llu\n", options.seek_frame);
+                exit(EXIT_FAILURE);
             }
+            memcpy(&keyframe, stored, sizeof(keyframe));
+            restore(keyframe);
+            hw.begin_speculation();
+            while((hw.frame < options.seek_frame) && !PlatformInterface::quit_requested) {
+                run_frame(unseen);
+            }
+            hw.end_speculation();
+            hw.resync_audio();
+            hw.capture.set_frame(hw.frame);
+            printf("seek to frame %llu took %.3f ms from keyframe at frame %llu\n", options.seek_frame,
+                std::chrono::duration<double, std::milli>(timer::now() - start).count(), (unsigned long long)keyframe_frame);
         }
-        // printf("clk = %llu\n", (clk_t)clk);
-        if(hw.wait_for_hsync) {
-            int current_line = hw.scanline;
-            auto cycles = hw.advance_to_hsync(clk);
-            clk.add_pixel_cycles(cycles);
-            memcpy(screen + Stella::clocks_per_line * current_line, hw.previous_row, Stella::clocks_per_line);
-            if(hw.scanline == 0) {
-                PlatformInterface::Frame(screen, 1.0f);
+
+        // Frames skipped by a seek don't count toward the speed reported
+        auto emulation_start = timer::now();
+        uint64_t first_frame = hw.frame;
+        clk_t first_clock = hw.tia_clock;
+
+        while(!PlatformInterface::quit_requested) {
+            if(options.frame_limit && (hw.frame >= options.frame_limit)) {
+                double seconds = std::chrono::duration<double>(timer::now() - emulation_start).count();
+                double emulated = (double)(hw.tia_clock - first_clock) / hw.clock_rate;
+                printf("ran %llu frames in %.3f s, %.1f times real time\n",
+                    (unsigned long long)(hw.frame - first_frame), seconds, emulated / seconds);
+                PlatformInterface::quit_requested = true;
+                break;
             }
-        }// else {
-          //  hw.advance_to_clock(clk);
-        //}
+            if(hw.keyframe_pending) {
+                save(keyframe);
+                hw.movie_out.write_keyframe(&keyframe, sizeof(keyframe));
+                hw.keyframe_pending = false;
+            }
+
+            if(options.run_ahead == 0) {
+                run_frame(screen);
+                if(video.file) {
+                    video.add_frame(screen);
+                }
+                screen = PlatformInterface::Frame(screen, 1.0f);
+                continue;
+            }
+
+            // Run the real frame, whose audio is heard but picture never
+            // shown, then show the frame run_ahead frames later with the
+            // same input and roll back to the real one
+            auto start = timer::now();
+            run_frame(unseen);
+            if(video.file) {
+                video.add_frame(unseen);
+            }
+            auto speculation_start = timer::now();
+            save(before_speculation);
+            hw.begin_speculation();
+            for(int i = 0; i < options.run_ahead - 1; i++) {
+                run_frame(unseen);
+            }
+            run_frame(screen);
+            restore(before_speculation);
+            hw.end_speculation();
+            auto end = timer::now();
+
+            real_time += speculation_start - start;
+            ahead_time += end - speculation_start;
+            if(PlatformInterface::print_stats && (++timed_frames == PlatformInterface::stats_interval)) {
+                double real_ms = std::chrono::duration<double, std::milli>(real_time).count() / timed_frames;
+                double ahead_ms = std::chrono::duration<double, std::milli>(ahead_time).count() / timed_frames;
+                fprintf(stderr, "run-ahead %d frames costs %.3f ms per frame on top of %.3f ms, %.0f%% more CPU\n",
+                    options.run_ahead, ahead_ms, real_ms, ahead_ms / real_ms * 100);
+                real_time = ahead_time = timer::duration{0};
+                timed_frames = 0;
+            }
+
+            screen = PlatformInterface::Frame(screen, 1.0f);
+        }
+    });
+
+    PlatformInterface::PresentFrames();
+    emulation.join();
+    video.close();
+    hw.wav.close();
+    hw.capture.close();
+    Trace::close();
+
+    if(options.profile_filename) {
+        if(!write_cpu_profile(options.profile_filename, cpu)) {
+            fprintf(stderr, "couldn't open %s for writing\n", options.profile_filename);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(hw.AR.load_failed) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *progname = argv[0];
+    argc--;
+    argv++;
+
+    emulation_options options;
+    bool pacing_given = false;
+    bool palette_given = false;
+
+    while((argc > 0) && (argv[0][0] == '-')) {
+        if((strcmp(argv[0], "--audio-trace") == 0) && (argc > 1)) {
+            options.audio_trace_filename = argv[1];
+            argc -= 2;
+            argv += 2;
+        } else if((strcmp(argv[0], "--capture") == 0) && (argc > 1)) {
+            options.capture_filename = argv[1];
+            argc -= 2;
+            argv += 2;
+        } else if((strcmp(argv[0], "--capture-frames") == 0) && (argc > 1)) {
+            int fields = sscanf(argv[1], "%llu-%llu", &options.capture_first_frame, &options.capture_last_frame);
+            if(fields == 1) {
+                options.capture_last_frame = options.capture_first_frame;
+            } else if(fields != 2) {
+                fprintf(stderr, "expected frame range \"first-last\" or \"frame\", got \"%s\"\n", argv[1]);
+                exit(EXIT_FAILURE);
+            }
+            argc -= 2;
+            argv += 2;
+        } else if((strcmp(argv[0], "--trace") == 0) && (argc > 1)) {
+            options.trace_filename = argv[1];
+            argc -= 2;
+            argv += 2;
+        } else if((strcmp(argv[0], "--trace-frames") == 0) && (argc > 1)) {
+            int fields = sscanf(argv[1], "%llu-%llu", &options.trace_first_frame, &options.trace_last_frame);
+            if(fields == 1) {
+                options.trace_last_frame = options.trace_first_frame;
+            } else if(fields != 2) {
+                fprintf(stderr, "expected frame range \"first-last\" or \"frame\", got \"%s\"\n", argv[1]);
+                exit(EXIT_FAILURE);
+            }
+            argc -= 2;
+            argv += 2;
+        } else if((strcmp(argv[0], "--run-ahead") == 0) && (argc > 1)) {
+            options.run_ahead = atoi(argv[1]);
+            if((options.run_ahead < 0) || (options.run_ahead > 8)) {
+                fprintf(stderr, "run-ahead must be 0 through 8 frames\n");
+                exit(EXIT_FAILURE);
+            }
+            argc -= 2;
+            argv += 2;
+        } else if((strcmp(argv[0], "--record") == 0) && (argc > 1)) {
+            options.record_filename = argv[1];
+            argc -= 2;
+            argv += 2;
+        } else if((strcmp(argv[0], "--keyframe-interval") == 0) && (argc > 1)) {
+            options.keyframe_interval = atoi(argv[1]);
+            if(options.keyframe_interval < 1) {
+                fprintf(stderr, "keyframe interval must be at least 1 frame\n");
+                exit(EXIT_FAILURE);
+            }
+            argc -= 2;
+            argv += 2;
+        } else if((strcmp(argv[0], "--play") == 0) && (argc > 1)) {
+            options.play_filename = argv[1];
+            argc -= 2;
+            argv += 2;
+        } else if((strcmp(argv[0], "--seek") == 0) && (argc > 1)) {
+            options.seek_frame = strtoull(argv[1], nullptr, 10);
+            argc -= 2;
+            argv += 2;
+        } else if((strcmp(argv[0], "--video") == 0) && (argc > 1)) {
+            options.video_filename = argv[1];
+            argc -= 2;
+            argv += 2;
+        } else if((strcmp(argv[0], "--video-format") == 0) && (argc > 1)) {
+            if(strcmp(argv[1], "y4m") == 0) {
+                options.video_format = VideoCapture::Y4M;
+            } else if(strcmp(argv[1], "raw") == 0) {
+                options.video_format = VideoCapture::RAW;
+            } else if(strcmp(argv[1], "gray") == 0) {
+                options.video_format = VideoCapture::GRAY;
+            } else if(strcmp(argv[1], "rgb") == 0) {
+                options.video_format = VideoCapture::RGB;
+            } else if(strcmp(argv[1], "obs") == 0) {
+                options.video_format = VideoCapture::OBS;
+            } else {
+                fprintf(stderr, "unknown video format \"%s\", expected y4m, raw, gray, rgb, or obs\n", argv[1]);
+                exit(EXIT_FAILURE);
+            }
+            argc -= 2;
+            argv += 2;
+        } else if((strcmp(argv[0], "--tv") == 0) && (argc > 1)) {
+            if(strcmp(argv[1], "ntsc") == 0) {
+                options.tv_standard = Stella::NTSC;
+            } else if(strcmp(argv[1], "pal") == 0) {
+                options.tv_standard = Stella::PAL;
+            } else if(strcmp(argv[1], "secam") == 0) {
+                options.tv_standard = Stella::SECAM;
+            } else {
+                fprintf(stderr, "unknown TV standard \"%s\", expected ntsc, pal, or secam\n", argv[1]);
+                exit(EXIT_FAILURE);
+            }
+            argc -= 2;
+            argv += 2;
+        } else if((strcmp(argv[0], "--palette") == 0) && (argc > 1)) {
+            if(strcmp(argv[1], "ntsc") == 0) {
+                PlatformInterface::palette_standard = Stella::NTSC;
+            } else if(strcmp(argv[1], "pal") == 0) {
+                PlatformInterface::palette_standard = Stella::PAL;
+            } else if(strcmp(argv[1], "secam") == 0) {
+                PlatformInterface::palette_standard = Stella::SECAM;
+            } else {
+                fprintf(stderr, "unknown palette \"%s\", expected ntsc, pal, or secam\n", argv[1]);
+                exit(EXIT_FAILURE);
+            }
+            palette_given = true;
+            argc -= 2;
+            argv += 2;
+        } else if((strcmp(argv[0], "--wav") == 0) && (argc > 1)) {
+            options.wav_filename = argv[1];
+            argc -= 2;
+            argv += 2;
+        } else if((strcmp(argv[0], "--wav-format") == 0) && (argc > 1)) {
+            if(strcmp(argv[1], "u8") == 0) {
+                options.wav_format = WAV::U8;
+            } else if(strcmp(argv[1], "s16") == 0) {
+                options.wav_format = WAV::S16;
+            } else if(strcmp(argv[1], "float") == 0) {
+                options.wav_format = WAV::FLOAT;
+            } else {
+                fprintf(stderr, "unknown WAV format \"%s\", expected u8, s16, or float\n", argv[1]);
+                exit(EXIT_FAILURE);
+            }
+            argc -= 2;
+            argv += 2;
+        } else if((strcmp(argv[0], "--wav-rate") == 0) && (argc > 1)) {
+            options.wav_rate = atoi(argv[1]);
+            if((options.wav_rate < 8000) || (options.wav_rate > 192000)) {
+                fprintf(stderr, "WAV sample rate must be 8000 through 192000\n");
+                exit(EXIT_FAILURE);
+            }
+            argc -= 2;
+            argv += 2;
+        } else if(strcmp(argv[0], "--headless") == 0) {
+            PlatformInterface::headless = true;
+            argc -= 1;
+            argv += 1;
+        } else if((strcmp(argv[0], "--profile") == 0) && (argc > 1)) {
+            if(!PROFILE_6502) {
+                fprintf(stderr, "--profile needs a build with PROFILE=1\n");
+                exit(EXIT_FAILURE);
+            }
+            options.profile_filename = argv[1];
+            argc -= 2;
+            argv += 2;
+        } else if((strcmp(argv[0], "--frames") == 0) && (argc > 1)) {
+            options.frame_limit = strtoull(argv[1], nullptr, 10);
+            argc -= 2;
+            argv += 2;
+        } else if((strcmp(argv[0], "--scale") == 0) && (argc > 1)) {
+            int factor = atoi(argv[1]);
+            if((factor < integer_scaler::min_factor) || (factor > integer_scaler::max_factor)) {
+                fprintf(stderr, "scale must be %d through %d\n", integer_scaler::min_factor, integer_scaler::max_factor);
+                exit(EXIT_FAILURE);
+            }
+            PlatformInterface::scaler.factor = factor;
+            argc -= 2;
+            argv += 2;
+        } else if(strcmp(argv[0], "--scanlines") == 0) {
+            PlatformInterface::scaler.scanlines = true;
+            argc -= 1;
+            argv += 1;
+        } else if(strcmp(argv[0], "--full-frame") == 0) {
+            PlatformInterface::show_full_frame = true;
+            argc -= 1;
+            argv += 1;
+        } else if(strcmp(argv[0], "--stats") == 0) {
+            PlatformInterface::print_stats = true;
+            argc -= 1;
+            argv += 1;
+        } else if(strcmp(argv[0], "--latency") == 0) {
+            PlatformInterface::measure_latency = true;
+            argc -= 1;
+            argv += 1;
+        } else if((strcmp(argv[0], "--pace") == 0) && (argc > 1)) {
+            if(strcmp(argv[1], "audio") == 0) {
+                PlatformInterface::pacer.pacing = frame_pacer::PACE_AUDIO;
+            } else if(strcmp(argv[1], "display") == 0) {
+                PlatformInterface::pacer.pacing = frame_pacer::PACE_DISPLAY;
+            } else if(strcmp(argv[1], "clock") == 0) {
+                PlatformInterface::pacer.pacing = frame_pacer::PACE_CLOCK;
+            } else if(strcmp(argv[1], "none") == 0) {
+                PlatformInterface::pacer.pacing = frame_pacer::PACE_NONE;
+            } else {
+                fprintf(stderr, "unknown pacing \"%s\", expected audio, display, clock, or none\n", argv[1]);
+                exit(EXIT_FAILURE);
+            }
+            pacing_given = true;
+            argc -= 2;
+            argv += 2;
+        } else {
+            fprintf(stderr, "unknown option \"%s\"\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(PlatformInterface::headless) {
+        if(!pacing_given) {
+            PlatformInterface::pacer.pacing = frame_pacer::PACE_NONE;
+        } else if(PlatformInterface::pacer.pacing == frame_pacer::PACE_DISPLAY) {
+            fprintf(stderr, "can't pace to the display when headless\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(argc < 1) {
+        fprintf(stderr, "usage: %s [--headless] [--pace audio|display|clock|none] [--frames count] [--profile file] [--trace file [--trace-frames first-last]] [--audio-trace file] [--capture file [--capture-frames first-last]] [--tv ntsc|pal|secam] [--palette ntsc|pal|secam] [--full-frame] [--scale 2|3|4] [--scanlines] [--latency] [--stats] [--run-ahead frames] [--record movie [--keyframe-interval frames]] [--play movie [--seek frame]] [--video file [--video-format y4m|raw|gray|rgb|obs]] [--wav file [--wav-format u8|s16|float] [--wav-rate hz]] cartridge-rom-file\n", progname);
+        exit(EXIT_FAILURE);
+    }
+    FILE *ROMfile = fopen(argv[0], "rb");
+    if(ROMfile == nullptr) {
+        std::cerr << "couldn't open " << argv[0] << " for reading.\n";
+        exit(EXIT_FAILURE);
+    }
+    fseek(ROMfile, 0, SEEK_END);
+    long length = ftell(ROMfile);
+    fseek(ROMfile, 0, SEEK_SET);
+    std::vector<uint8_t> ROM;
+    ROM.resize(length);
+    fread(ROM.data(), length, 1, ROMfile);
+
+    // Each standard's own colors unless --palette says otherwise
+    if(!palette_given) {
+        PlatformInterface::palette_standard = options.tv_standard;
+    }
+
+    switch(options.tv_standard) {
+        case Stella::NTSC: emulate<Stella::NTSC_timing>(ROM, options); break;
+        case Stella::PAL: emulate<Stella::PAL_timing>(ROM, options); break;
+        case Stella::SECAM: emulate<Stella::SECAM_timing>(ROM, options); break;
     }
+    exit(EXIT_SUCCESS);
 }
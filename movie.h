@@ -0,0 +1,224 @@
+/*
+    Input movies
+
+    Recorded with --record and replayed with --play; emulation is
+    deterministic given the input latched each frame, so that's all a
+    movie needs besides periodic keyframes of the whole machine, which
+    let --seek start near any frame instead of replaying from reset.
+
+    The file is a header and then equal-sized chunks, one per keyframe:
+
+        header  "TIAMOVIE", then uint32 version, keyframe interval in
+                frames, keyframe size, and ROM hash
+        chunk   keyframe (machine snapshot taken as its first frame
+                starts), then keyframe-interval movie_input records of
+                uint32 frame, SWCHA, SWCHB, INPT4, INPT5, and four uint16
+                paddles
+
+    Header words and input records are little-endian on any host.
+
+    Chunk k holds frames k * interval onward, so finding any frame is
+    arithmetic.  The last chunk may be short.  Keyframes are raw
+    snapshots, so a movie only plays back on the build that made it;
+    the size in the header catches most mismatches.
+*/
+
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace Movie
+{
+    static constexpr char magic[8] = {'T', 'I', 'A', 'M', 'O', 'V', 'I', 'E'};
+    static constexpr uint32_t version = 1;
+    static constexpr size_t header_size = 24;
+    static constexpr uint32_t default_keyframe_interval = 60;
+
+    // FNV-1a, to catch playing a movie against the wrong cartridge
+    inline uint32_t hash(const std::vector<uint8_t>& data)
+    {
+        uint32_t h = 2166136261u;
+        for(uint8_t b: data) {
+            h = (h ^ b) * 16777619u;
+        }
+        return h;
+    }
+
+    inline void put_le(uint8_t *p, uint32_t v, int bytes)
+    {
+        for(int i = 0; i < bytes; i++) {
+            p[i] = v >> (i * 8);
+        }
+    }
+
+    inline uint32_t get_le(const uint8_t *p, int bytes)
+    {
+        uint32_t v = 0;
+        for(int i = 0; i < bytes; i++) {
+            v |= (uint32_t)p[i] << (i * 8);
+        }
+        return v;
+    }
+}
+
+// What the console latched from controllers and switches for a frame
+struct movie_input
+{
+    uint32_t frame; // checked on playback
+    uint8_t SWCHA;
+    uint8_t SWCHB;
+    uint8_t INPT4;
+    uint8_t INPT5;
+    uint16_t paddles[4];
+
+    static constexpr size_t record_size = 16;
+
+    void encode(uint8_t *p) const
+    {
+        using namespace Movie;
+        put_le(p + 0, frame, 4);
+        p[4] = SWCHA;
+        p[5] = SWCHB;
+        p[6] = INPT4;
+        p[7] = INPT5;
+        for(int i = 0; i < 4; i++) {
+            put_le(p + 8 + i * 2, paddles[i], 2);
+        }
+    }
+
+    void decode(const uint8_t *p)
+    {
+        using namespace Movie;
+        frame = get_le(p + 0, 4);
+        SWCHA = p[4];
+        SWCHB = p[5];
+        INPT4 = p[6];
+        INPT5 = p[7];
+        for(int i = 0; i < 4; i++) {
+            paddles[i] = get_le(p + 8 + i * 2, 2);
+        }
+    }
+};
+
+struct movie_writer
+{
+    FILE *file = nullptr;
+    uint32_t keyframe_interval = Movie::default_keyframe_interval;
+
+    bool open(const char *filename, uint32_t interval, uint32_t keyframe_size, uint32_t ROM_hash)
+    {
+        file = fopen(filename, "wb");
+        if(file == nullptr) {
+            return false;
+        }
+        setvbuf(file, nullptr, _IOFBF, 1 << 16);
+        keyframe_interval = interval;
+        uint8_t header[Movie::header_size];
+        uint32_t words[4] = {Movie::version, interval, keyframe_size, ROM_hash};
+        memcpy(header, Movie::magic, sizeof(Movie::magic));
+        for(int i = 0; i < 4; i++) {
+            Movie::put_le(header + 8 + i * 4, words[i], 4);
+        }
+        fwrite(header, sizeof(header), 1, file);
+        return true;
+    }
+
+    bool keyframe_due(uint64_t frame) const
+    {
+        return (file != nullptr) && (frame % keyframe_interval == 0);
+    }
+
+    void write_keyframe(const void *snapshot, size_t size)
+    {
+        fwrite(snapshot, size, 1, file);
+    }
+
+    void write_input(const movie_input& input)
+    {
+        uint8_t record[movie_input::record_size];
+        input.encode(record);
+        fwrite(record, sizeof(record), 1, file);
+    }
+};
+
+struct movie_reader
+{
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    uint32_t keyframe_interval = 0;
+    uint32_t keyframe_size = 0;
+    uint32_t ROM_hash = 0;
+
+    bool open(const char *filename)
+    {
+        int fd = ::open(filename, O_RDONLY);
+        if(fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if((fstat(fd, &st) != 0) || (st.st_size < (off_t)Movie::header_size)) {
+            ::close(fd);
+            return false;
+        }
+        size = st.st_size;
+        void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if(mapped == MAP_FAILED) {
+            return false;
+        }
+        data = static_cast<const uint8_t*>(mapped);
+        uint32_t words[4];
+        for(int i = 0; i < 4; i++) {
+            words[i] = Movie::get_le(data + 8 + i * 4, 4);
+        }
+        if((memcmp(data, Movie::magic, sizeof(Movie::magic)) != 0) || (words[0] != Movie::version) || (words[1] == 0)) {
+            munmap(mapped, size);
+            data = nullptr;
+            return false;
+        }
+        keyframe_interval = words[1];
+        keyframe_size = words[2];
+        ROM_hash = words[3];
+        return true;
+    }
+
+    size_t chunk_size() const
+    {
+        return keyframe_size + (size_t)keyframe_interval * movie_input::record_size;
+    }
+
+    // Latest keyframe at or before "frame", or nullptr past the end
+    const uint8_t *keyframe_before(uint64_t frame, uint64_t& keyframe_frame) const
+    {
+        uint64_t chunk = frame / keyframe_interval;
+        size_t offset = Movie::header_size + chunk * chunk_size();
+        if(offset + keyframe_size > size) {
+            return nullptr;
+        }
+        keyframe_frame = chunk * keyframe_interval;
+        return data + offset;
+    }
+
+    // Returns false past the end of the movie
+    bool input(uint64_t frame, movie_input& out) const
+    {
+        uint64_t chunk = frame / keyframe_interval;
+        size_t offset = Movie::header_size + chunk * chunk_size() + keyframe_size + (frame % keyframe_interval) * movie_input::record_size;
+        if(offset + movie_input::record_size > size) {
+            return false;
+        }
+        out.decode(data + offset);
+        return out.frame == frame;
+    }
+};
+
+#endif /* MOVIE_H */
@@ -0,0 +1,134 @@
+/*
+    Observations for learning agents
+
+    Agents trained on Atari games usually see each frame as its 160x210
+    picture in gray, maxed pixel by pixel with the frame before to undo
+    sprite flicker, and shrunk to 84x84 by averaging areas.
+    observation_builder makes that from a frame of COLU values in one
+    pass, a line at a time, keeping only the previous frame's gray
+    picture between calls:
+
+        each source line    luma lookup (frame_convert.h) and maximum
+                            with the previous frame's line, 16 pixels
+                            at a time with SSE2 or NEON
+        vertically          each source line adds into the columns of
+                            the one or two output lines it overlaps,
+                            weighted by the overlap
+        horizontally        once an output line's columns are complete,
+                            each output pixel sums the 2 or 3 columns it
+                            overlaps, weighted the same way
+
+    Weights are exact integers: measured in 84ths of a source pixel, an
+    output pixel is 160 units wide and 210 tall and a source pixel is
+    84 by 84, so every output pixel's weights sum to 160 * 210.
+*/
+
+#ifndef OBSERVATION_H
+#define OBSERVATION_H
+
+#include <algorithm>
+#include <cstring>
+#include <cinttypes>
+
+#include "frame_convert.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+struct observation_builder
+{
+    static constexpr int width = 84;
+    static constexpr int height = 84;
+    static constexpr int source_width = 160;
+    static constexpr int source_height = 210;
+    static constexpr uint32_t weight_sum = source_width * source_height;
+
+    frame_converter converter;
+    uint32_t left = 0; // of the source area, in clocks and lines
+    uint32_t top = 0;
+    alignas(16) uint8_t previous[source_height][source_width] = {}; // gray
+
+    // Output pixel i is tap_weights[i] times source pixels tap_first[i] onward
+    uint8_t tap_first[width];
+    uint8_t tap_weights[width][3];
+
+    observation_builder()
+    {
+        for(int i = 0; i < width; i++) {
+            int start = i * source_width;
+            int end = start + source_width;
+            tap_first[i] = start / width;
+            for(int k = 0; k < 3; k++) {
+                int j = tap_first[i] + k;
+                tap_weights[i][k] = std::max(0, std::min((j + 1) * width, end) - std::max(j * width, start));
+            }
+        }
+    }
+
+    void set_area(uint32_t left_, uint32_t top_)
+    {
+        left = left_;
+        top = top_;
+    }
+
+    // Replaces "gray" with its maximum with "saved", and saves the original
+    static void max_and_save(uint8_t *gray, uint8_t *saved)
+    {
+        int i = 0;
+#if defined(__SSE2__)
+        for(; i + 16 <= source_width; i += 16) {
+            __m128i g = _mm_load_si128(reinterpret_cast<const __m128i*>(gray + i));
+            __m128i s = _mm_load_si128(reinterpret_cast<const __m128i*>(saved + i));
+            _mm_store_si128(reinterpret_cast<__m128i*>(saved + i), g);
+            _mm_store_si128(reinterpret_cast<__m128i*>(gray + i), _mm_max_epu8(g, s));
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        for(; i + 16 <= source_width; i += 16) {
+            uint8x16_t g = vld1q_u8(gray + i);
+            uint8x16_t s = vld1q_u8(saved + i);
+            vst1q_u8(saved + i, g);
+            vst1q_u8(gray + i, vmaxq_u8(g, s));
+        }
+#endif
+        for(; i < source_width; i++) {
+            uint8_t g = gray[i];
+            gray[i] = std::max(g, saved[i]);
+            saved[i] = g;
+        }
+    }
+
+    // "frame" holds "stride" COLU values per line; writes width * height bytes
+    void build(const uint8_t *frame, size_t stride, uint8_t *out)
+    {
+        alignas(16) uint8_t gray[source_width];
+        // Columns of output lines "line" and "line" + 1, at most 255 * 210
+        alignas(16) uint16_t columns[2][source_width + 2] = {}; // the last taps read past the end with weight 0
+        int line = 0;
+
+        for(int y = 0; y < source_height; y++) {
+            converter.to_gray(frame + (top + y) * stride + left, source_width, gray);
+            max_and_save(gray, previous[y]);
+
+            uint16_t upper = std::min((y + 1) * height, (line + 1) * source_height) - y * height;
+            uint16_t lower = height - upper;
+            for(int i = 0; i < source_width; i++) {
+                columns[0][i] += upper * gray[i];
+                columns[1][i] += lower * gray[i];
+            }
+
+            if((y + 1) * height >= (line + 1) * source_height) {
+                for(int i = 0; i < width; i++) {
+                    const uint16_t *c = columns[0] + tap_first[i];
+                    uint32_t sum = tap_weights[i][0] * c[0] + tap_weights[i][1] * c[1] + tap_weights[i][2] * c[2];
+                    out[line * width + i] = (sum + weight_sum / 2) / weight_sum;
+                }
+                memcpy(columns[0], columns[1], sizeof(columns[0]));
+                memset(columns[1], 0, sizeof(columns[1]));
+                line++;
+            }
+        }
+    }
+};
+
+#endif /* OBSERVATION_H */
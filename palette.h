@@ -0,0 +1,155 @@
+/*
+    TIA palettes, and every form of them, built at compile time
+
+    COLUxx is a hue in bits 7-4 and a luminance in bits 3-1; bit 0 is
+    ignored, so a palette has 128 colors, indexed by COLU >> 1.
+
+        NTSC    the palette getpalette.py measured from a screenshot,
+                kept as data so colors stay exactly as they were
+        PAL     generated as points in YUV from the NTSC gray ramp and
+                a brighter ramp for colors, which is how TVs of the
+                time showed chroma; hues 0, 1, 14, and 15 are gray, and
+                even and odd hues run in opposite directions around the
+                wheel, since PAL alternates the phase of V every line
+        SECAM   hue is ignored; the three luminance bits switch blue,
+                red, and green fully on or off
+
+    Each palette comes with the forms consumers draw with, so output
+    only ever looks colors up: RGB bytes, RGB565, RGBA8888 and
+    ARGB8888 as packed 32-bit values, BT.601 luma, and BT.601
+    limited-range Y, Cb, and Cr.
+*/
+
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <cinttypes>
+#include "stella.h"
+
+namespace Palette
+{
+    static constexpr double pi = 3.14159265358979323846;
+
+    // std::sin and std::cos aren't constexpr
+    constexpr double sine(double degrees)
+    {
+        while(degrees > 180) {
+            degrees -= 360;
+        }
+        while(degrees < -180) {
+            degrees += 360;
+        }
+        double x = degrees * pi / 180;
+        double term = x;
+        double sum = x;
+        for(int n = 1; n < 12; n++) {
+            term *= -x * x / ((2 * n) * (2 * n + 1));
+            sum += term;
+        }
+        return sum;
+    }
+
+    constexpr double cosine(double degrees)
+    {
+        return sine(degrees + 90);
+    }
+
+    constexpr uint8_t to_byte(double v)
+    {
+        return (v <= 0) ? 0 : ((v >= 255) ? 255 : (uint8_t)(v + 0.5));
+    }
+
+    static constexpr double gray_luma[8] = {0, 64, 108, 144, 176, 200, 220, 236};
+    static constexpr double color_luma[8] = {43, 72, 101, 125, 147, 168, 189, 209};
+
+    // Hues 2 through 13; the rest are gray
+    static constexpr double PAL_hue_angles[16] = {0, 0, 143, 189, 127, 250, 97, 283, 70, 307, 50, 325, 33, 347, 0, 0};
+    static constexpr double PAL_saturation = 50;
+
+    struct rgb
+    {
+        uint8_t r, g, b;
+    };
+
+    // By hue, then luminance
+    static constexpr rgb NTSC_colors[128] = {
+        /* 0 */ {0x00, 0x00, 0x00}, {0x40, 0x40, 0x40}, {0x6C, 0x6C, 0x6C}, {0x90, 0x90, 0x90}, {0xB0, 0xB0, 0xB0}, {0xC8, 0xC8, 0xC8}, {0xDC, 0xDC, 0xDC}, {0xEC, 0xEC, 0xEC},
+        /* 1 */ {0x44, 0x44, 0x00}, {0x64, 0x64, 0x10}, {0x84, 0x84, 0x24}, {0xA0, 0xA0, 0x34}, {0xB8, 0xB8, 0x40}, {0xD0, 0xD0, 0x50}, {0xE8, 0xE8, 0x5C}, {0xFC, 0xFC, 0x68},
+        /* 2 */ {0x70, 0x28, 0x00}, {0x84, 0x44, 0x14}, {0x98, 0x5C, 0x28}, {0xAC, 0x78, 0x3C}, {0xBC, 0x8C, 0x4C}, {0xCC, 0xA0, 0x5C}, {0xDC, 0xB4, 0x68}, {0xE8, 0xCC, 0x7C},
+        /* 3 */ {0x84, 0x18, 0x00}, {0x98, 0x34, 0x18}, {0xAC, 0x50, 0x30}, {0xC0, 0x68, 0x48}, {0xD0, 0x80, 0x5C}, {0xE0, 0x94, 0x70}, {0xEC, 0xA8, 0x80}, {0xFC, 0xBC, 0x94},
+        /* 4 */ {0x88, 0x00, 0x00}, {0x9C, 0x20, 0x20}, {0xB0, 0x3C, 0x3C}, {0xC0, 0x58, 0x58}, {0xD0, 0x70, 0x70}, {0xE0, 0x88, 0x88}, {0xEC, 0xA0, 0xA0}, {0xFC, 0xB4, 0xB4},
+        /* 5 */ {0x78, 0x00, 0x5C}, {0x8C, 0x20, 0x74}, {0xA0, 0x3C, 0x88}, {0xB0, 0x58, 0x9C}, {0xC0, 0x70, 0xB0}, {0xD0, 0x84, 0xC0}, {0xDC, 0x9C, 0xD0}, {0xEC, 0xB0, 0xE0},
+        /* 6 */ {0x48, 0x00, 0x78}, {0x60, 0x20, 0x90}, {0x78, 0x3C, 0xA4}, {0x8C, 0x58, 0xB8}, {0xA0, 0x70, 0xCC}, {0xB4, 0x84, 0xDC}, {0xC4, 0x9C, 0xEC}, {0xD4, 0xB0, 0xFC},
+        /* 7 */ {0x14, 0x00, 0x84}, {0x30, 0x20, 0x98}, {0x4C, 0x3C, 0xAC}, {0x68, 0x58, 0xC0}, {0x7C, 0x70, 0xD0}, {0x94, 0x88, 0xE0}, {0xA8, 0xA0, 0xEC}, {0xBC, 0xB4, 0xFC},
+        /* 8 */ {0x00, 0x00, 0x88}, {0x1C, 0x20, 0x9C}, {0x38, 0x40, 0xB0}, {0x50, 0x5C, 0xC0}, {0x68, 0x74, 0xD0}, {0x7C, 0x8C, 0xE0}, {0x90, 0xA4, 0xEC}, {0xA4, 0xB8, 0xFC},
+        /* 9 */ {0x00, 0x18, 0x7C}, {0x1C, 0x38, 0x90}, {0x38, 0x54, 0xA8}, {0x50, 0x70, 0xBC}, {0x68, 0x88, 0xCC}, {0x7C, 0x9C, 0xDC}, {0x90, 0xB4, 0xEC}, {0xA4, 0xC8, 0xFC},
+        /* A */ {0x00, 0x2C, 0x5C}, {0x1C, 0x4C, 0x78}, {0x38, 0x68, 0x90}, {0x50, 0x84, 0xAC}, {0x68, 0x9C, 0xC0}, {0x7C, 0xB4, 0xD4}, {0x90, 0xCC, 0xE8}, {0xA4, 0xE0, 0xFC},
+        /* B */ {0x00, 0x40, 0x2C}, {0x1C, 0x5C, 0x48}, {0x38, 0x7C, 0x64}, {0x50, 0x9C, 0x80}, {0x68, 0xB4, 0x94}, {0x7C, 0xD0, 0xAC}, {0x90, 0xE4, 0xC0}, {0xA4, 0xFC, 0xD4},
+        /* C */ {0x00, 0x3C, 0x00}, {0x20, 0x5C, 0x20}, {0x40, 0x7C, 0x40}, {0x5C, 0x9C, 0x5C}, {0x74, 0xB4, 0x74}, {0x8C, 0xD0, 0x8C}, {0xA4, 0xE4, 0xA4}, {0xB8, 0xFC, 0xB8},
+        /* D */ {0x14, 0x38, 0x00}, {0x34, 0x5C, 0x1C}, {0x50, 0x7C, 0x38}, {0x6C, 0x98, 0x50}, {0x84, 0xB4, 0x68}, {0x9C, 0xCC, 0x7C}, {0xB4, 0xE4, 0x90}, {0xC8, 0xFC, 0xA4},
+        /* E */ {0x2C, 0x30, 0x00}, {0x4C, 0x50, 0x1C}, {0x68, 0x70, 0x34}, {0x84, 0x8C, 0x4C}, {0x9C, 0xA8, 0x64}, {0xB4, 0xC0, 0x78}, {0xCC, 0xD4, 0x88}, {0xE0, 0xEC, 0x9C},
+        /* F */ {0x44, 0x28, 0x00}, {0x64, 0x48, 0x18}, {0x84, 0x68, 0x30}, {0xA0, 0x84, 0x44}, {0xB8, 0x9C, 0x58}, {0xD0, 0xB4, 0x6C}, {0xE8, 0xCC, 0x7C}, {0xFC, 0xE0, 0x8C},
+    };
+
+    constexpr rgb from_yuv(double y, double u, double v)
+    {
+        return rgb{to_byte(y + 1.140 * v), to_byte(y - 0.395 * u - 0.581 * v), to_byte(y + 2.032 * u)};
+    }
+
+    constexpr rgb color(Stella::standard s, int hue, int lum)
+    {
+        switch(s) {
+            case Stella::NTSC:
+                return NTSC_colors[hue * 8 + lum];
+            case Stella::PAL:
+                if((hue < 2) || (hue > 13)) {
+                    return from_yuv(gray_luma[lum], 0, 0);
+                } else {
+                    double angle = PAL_hue_angles[hue];
+                    return from_yuv(color_luma[lum], PAL_saturation * cosine(angle), PAL_saturation * sine(angle));
+                }
+            case Stella::SECAM:
+            default:
+                return rgb{(uint8_t)((lum & 2) ? 255 : 0), (uint8_t)((lum & 4) ? 255 : 0), (uint8_t)((lum & 1) ? 255 : 0)};
+        }
+    }
+
+    // All indexed by COLU >> 1
+    struct tables
+    {
+        alignas(16) uint8_t luma[128];
+        rgb colors[128];
+        uint16_t rgb565[128];
+        uint32_t rgba8888[128]; // 0xRRGGBBAA
+        uint32_t argb8888[128]; // 0xAARRGGBB
+        uint8_t ycbcr[3][128]; // limited range, for video encoders
+    };
+
+    constexpr tables make_tables(Stella::standard s)
+    {
+        tables t{};
+        for(int i = 0; i < 128; i++) {
+            rgb c = color(s, i >> 3, i & 7);
+            t.colors[i] = c;
+            t.rgb565[i] = ((c.r >> 3) << 11) | ((c.g >> 2) << 5) | (c.b >> 3);
+            t.rgba8888[i] = ((uint32_t)c.r << 24) | ((uint32_t)c.g << 16) | ((uint32_t)c.b << 8) | 0xFF;
+            t.argb8888[i] = 0xFF000000u | ((uint32_t)c.r << 16) | ((uint32_t)c.g << 8) | c.b;
+            t.luma[i] = (77 * c.r + 150 * c.g + 29 * c.b + 128) >> 8;
+            t.ycbcr[0][i] = to_byte(16 + (65.481 * c.r + 128.553 * c.g + 24.966 * c.b) / 255);
+            t.ycbcr[1][i] = to_byte(128 + (-37.797 * c.r - 74.203 * c.g + 112.0 * c.b) / 255);
+            t.ycbcr[2][i] = to_byte(128 + (112.0 * c.r - 93.786 * c.g - 18.214 * c.b) / 255);
+        }
+        return t;
+    }
+
+    inline constexpr tables NTSC_tables = make_tables(Stella::NTSC);
+    inline constexpr tables PAL_tables = make_tables(Stella::PAL);
+    inline constexpr tables SECAM_tables = make_tables(Stella::SECAM);
+
+    constexpr const tables& get(Stella::standard s)
+    {
+        return (s == Stella::PAL) ? PAL_tables : ((s == Stella::SECAM) ? SECAM_tables : NTSC_tables);
+    }
+};
+
+#endif /* PALETTE_H */
@@ -0,0 +1,184 @@
+/*
+    TIA and RIOT register access capture
+
+    With --capture, every read and write of a TIA or RIOT register in
+    the selected frames is stored into a preallocated ring, and the ring
+    is written out at the end of each frame, so capturing never
+    allocates or formats text.  If a frame makes more accesses than the
+    ring holds, the oldest are dropped and counted.  With capture off
+    each access costs one well-predicted branch.
+
+    The file is a header and then fixed-size records, every field
+    little-endian whatever the host:
+
+        header  "TIACAPTR", uint32 version, uint32 record size
+        record  register_access's fields in order, then a zero byte to
+                make record_size bytes
+
+    capture_to_text prints a capture file.
+*/
+
+#ifndef REGISTER_CAPTURE_H
+#define REGISTER_CAPTURE_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <vector>
+
+namespace RegisterCapture
+{
+    static constexpr char magic[8] = {'T', 'I', 'A', 'C', 'A', 'P', 'T', 'R'};
+    static constexpr uint32_t version = 2;
+    static constexpr size_t header_size = 16;
+    static constexpr size_t record_size = 24;
+
+    enum {
+        WRITE = 0x01, // otherwise a read
+        HBLANK = 0x02, // access happened during horizontal blank
+    };
+
+    inline void put_le(uint8_t *p, uint64_t v, int bytes)
+    {
+        for(int i = 0; i < bytes; i++) {
+            p[i] = v >> (i * 8);
+        }
+    }
+
+    inline uint64_t get_le(const uint8_t *p, int bytes)
+    {
+        uint64_t v = 0;
+        for(int i = 0; i < bytes; i++) {
+            v |= (uint64_t)p[i] << (i * 8);
+        }
+        return v;
+    }
+};
+
+struct register_access
+{
+    uint64_t clock; // TIA clocks since power on
+    uint64_t frame;
+    uint16_t scanline;
+    uint8_t hclock;
+    uint8_t flags;
+    uint16_t address;
+    uint8_t value;
+
+    void encode(uint8_t *p) const
+    {
+        using namespace RegisterCapture;
+        put_le(p + 0, clock, 8);
+        put_le(p + 8, frame, 8);
+        put_le(p + 16, scanline, 2);
+        p[18] = hclock;
+        p[19] = flags;
+        put_le(p + 20, address, 2);
+        p[22] = value;
+        p[23] = 0;
+    }
+
+    void decode(const uint8_t *p)
+    {
+        using namespace RegisterCapture;
+        clock = get_le(p + 0, 8);
+        frame = get_le(p + 8, 8);
+        scanline = get_le(p + 16, 2);
+        hclock = p[18];
+        flags = p[19];
+        address = get_le(p + 20, 2);
+        value = p[22];
+    }
+};
+
+struct register_capture
+{
+    static constexpr size_t capacity = 1 << 16;
+    static constexpr size_t mask = capacity - 1;
+
+    FILE *file = nullptr;
+    bool enabled = false;
+    uint64_t first_frame = 0;
+    uint64_t last_frame = UINT64_MAX;
+    std::vector<register_access> ring;
+    uint64_t recorded = 0;
+    uint64_t written = 0;
+    uint64_t dropped = 0;
+
+    bool open(const char *filename, uint64_t first, uint64_t last)
+    {
+        file = fopen(filename, "wb");
+        if(file == nullptr) {
+            return false;
+        }
+        first_frame = first;
+        last_frame = last;
+        ring.resize(capacity);
+        uint8_t header[RegisterCapture::header_size];
+        memcpy(header, RegisterCapture::magic, sizeof(RegisterCapture::magic));
+        RegisterCapture::put_le(header + 8, RegisterCapture::version, 4);
+        RegisterCapture::put_le(header + 12, RegisterCapture::record_size, 4);
+        fwrite(header, sizeof(header), 1, file);
+        return true;
+    }
+
+    void record(uint64_t clock, uint64_t frame, uint16_t scanline, uint8_t hclock, uint16_t address, uint8_t value, uint8_t flags)
+    {
+        register_access& r = ring[recorded++ & mask];
+        r.clock = clock;
+        r.frame = frame;
+        r.scanline = scanline;
+        r.hclock = hclock;
+        r.flags = flags;
+        r.address = address;
+        r.value = value;
+    }
+
+    void drain()
+    {
+        if(recorded - written > capacity) {
+            dropped += recorded - written - capacity;
+            written = recorded - capacity;
+        }
+        uint8_t block[256 * RegisterCapture::record_size];
+        while(written < recorded) {
+            size_t count = std::min<uint64_t>(recorded - written, 256);
+            for(size_t i = 0; i < count; i++) {
+                ring[(written + i) & mask].encode(block + i * RegisterCapture::record_size);
+            }
+            fwrite(block, RegisterCapture::record_size, count, file);
+            written += count;
+        }
+    }
+
+    // Called as each frame starts; closes the file after the last frame
+    void set_frame(uint64_t frame)
+    {
+        if(file == nullptr) {
+            return;
+        }
+        drain();
+        enabled = (frame >= first_frame) && (frame <= last_frame);
+        if(frame > last_frame) {
+            close();
+        }
+    }
+
+    // Writes what the ring still holds, e.g. when emulation stops
+    // before the last frame
+    void close()
+    {
+        if(file == nullptr) {
+            return;
+        }
+        drain();
+        enabled = false;
+        fclose(file);
+        file = nullptr;
+        fprintf(stderr, "captured %llu register accesses, dropped %llu\n",
+            (unsigned long long)written, (unsigned long long)dropped);
+    }
+};
+
+#endif /* REGISTER_CAPTURE_H */
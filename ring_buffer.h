@@ -0,0 +1,64 @@
+/*
+    Lock-free single-producer, single-consumer ring buffer
+
+    One thread calls push() and another calls pop(); neither blocks.
+    Capacity must be a power of two.  Indices run freely and are
+    masked on access, so all of the capacity is usable.
+*/
+
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+
+template <class T, size_t CAPACITY>
+struct spsc_ring_buffer
+{
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "capacity must be a power of two");
+    static constexpr size_t mask = CAPACITY - 1;
+
+    T data[CAPACITY];
+    alignas(64) std::atomic<size_t> write_index{0};
+    alignas(64) std::atomic<size_t> read_index{0};
+
+    size_t capacity() const
+    {
+        return CAPACITY;
+    }
+
+    // Approximate from either side, exact from the caller's own side
+    size_t size() const
+    {
+        return write_index.load(std::memory_order_acquire) - read_index.load(std::memory_order_acquire);
+    }
+
+    // Returns number of elements actually queued
+    size_t push(const T* elements, size_t count)
+    {
+        size_t w = write_index.load(std::memory_order_relaxed);
+        size_t r = read_index.load(std::memory_order_acquire);
+        count = std::min(count, CAPACITY - (w - r));
+        for(size_t i = 0; i < count; i++) {
+            data[(w + i) & mask] = elements[i];
+        }
+        write_index.store(w + count, std::memory_order_release);
+        return count;
+    }
+
+    // Returns number of elements actually dequeued
+    size_t pop(T* elements, size_t count)
+    {
+        size_t r = read_index.load(std::memory_order_relaxed);
+        size_t w = write_index.load(std::memory_order_acquire);
+        count = std::min(count, w - r);
+        for(size_t i = 0; i < count; i++) {
+            elements[i] = data[(r + i) & mask];
+        }
+        read_index.store(r + count, std::memory_order_release);
+        return count;
+    }
+};
+
+#endif /* RING_BUFFER_H */
@@ -0,0 +1,127 @@
+/*
+    Integer scaling for presentation
+
+    Frames are scaled up on the CPU straight into a streaming texture
+    the size of the window, so the renderer only copies it and no GPU
+    or driver scaling is involved, which keeps software renderers fast.
+    Each TIA clock becomes 2 * factor pixels across, since a clock is
+    about twice as wide as a line is tall, and each line becomes factor
+    rows.  With scanlines, the last row of every line comes from a
+    darkened copy of the palette.
+
+    Source pixels go two at a time: two palette lookups, broadcast into
+    vectors and stored as "factor" vectors of 4 pixels to every output
+    row, so the frame is read once and the texture written once.  SSE2
+    or NEON, with a scalar fallback.
+*/
+
+#ifndef SCALER_H
+#define SCALER_H
+
+#include <cstddef>
+#include <cinttypes>
+
+#include "palette.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+struct integer_scaler
+{
+    static constexpr int min_factor = 2;
+    static constexpr int max_factor = 4;
+    static constexpr int scanline_brightness = 50; // percent
+
+    int factor = 2;
+    bool scanlines = false;
+    const uint32_t *colors = Palette::NTSC_tables.argb8888; // 0xAARRGGBB
+    uint32_t dark_colors[128];
+
+    integer_scaler()
+    {
+        set_palette(Palette::NTSC_tables);
+    }
+
+    void set_palette(const Palette::tables& tables)
+    {
+        colors = tables.argb8888;
+        for(int i = 0; i < 128; i++) {
+            const Palette::rgb& c = tables.colors[i];
+            uint32_t r = c.r * scanline_brightness / 100;
+            uint32_t g = c.g * scanline_brightness / 100;
+            uint32_t b = c.b * scanline_brightness / 100;
+            dark_colors[i] = 0xFF000000u | (r << 16) | (g << 8) | b;
+        }
+    }
+
+    // "width" COLU values, which must be even, from each of "height"
+    // lines "stride" apart, into ARGB8888 rows "pitch" bytes apart
+    void scale(const uint8_t *frame, size_t stride, int width, int height, uint8_t *out, int pitch) const
+    {
+        switch(factor) {
+            case 2: scale_lines<2>(frame, stride, width, height, out, pitch); break;
+            case 3: scale_lines<3>(frame, stride, width, height, out, pitch); break;
+            case 4: scale_lines<4>(frame, stride, width, height, out, pitch); break;
+        }
+    }
+
+    template <int F>
+    void scale_lines(const uint8_t *frame, size_t stride, int width, int height, uint8_t *out, int pitch) const
+    {
+        for(int y = 0; y < height; y++) {
+            const uint8_t *source = frame + y * stride;
+            uint32_t *rows[F];
+            for(int r = 0; r < F; r++) {
+                rows[r] = reinterpret_cast<uint32_t*>(out + (y * F + r) * pitch);
+            }
+            const uint32_t *last_row_colors = scanlines ? dark_colors : colors;
+            for(int x = 0; x < width; x += 2) {
+                uint8_t a = source[x] >> 1;
+                uint8_t b = source[x + 1] >> 1;
+                store_pair<F>(rows, F - 1, x * 2 * F, colors[a], colors[b]);
+                store_pair<F>(rows + F - 1, 1, x * 2 * F, last_row_colors[a], last_row_colors[b]);
+            }
+        }
+    }
+
+    // Two source pixels as 4 * F output pixels at "offset" in each of "count" rows;
+    // vector k holds pixel a, pixel b, or with odd F the middle one holds both
+    template <int F>
+    static void store_pair(uint32_t **rows, int count, int offset, uint32_t a, uint32_t b)
+    {
+#if defined(__SSE2__)
+        __m128i va = _mm_set1_epi32(a);
+        __m128i vb = _mm_set1_epi32(b);
+        __m128i vab = _mm_unpacklo_epi64(va, vb);
+        for(int r = 0; r < count; r++) {
+            __m128i *p = reinterpret_cast<__m128i*>(rows[r] + offset);
+            for(int k = 0; k < F; k++) {
+                _mm_storeu_si128(p + k, (2 * k + 1 < F) ? va : ((2 * k + 1 > F) ? vb : vab));
+            }
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        uint32x4_t va = vdupq_n_u32(a);
+        uint32x4_t vb = vdupq_n_u32(b);
+        uint32x4_t vab = vcombine_u32(vget_low_u32(va), vget_low_u32(vb));
+        for(int r = 0; r < count; r++) {
+            uint32_t *p = rows[r] + offset;
+            for(int k = 0; k < F; k++) {
+                vst1q_u32(p + k * 4, (2 * k + 1 < F) ? va : ((2 * k + 1 > F) ? vb : vab));
+            }
+        }
+#else
+        for(int r = 0; r < count; r++) {
+            uint32_t *p = rows[r] + offset;
+            for(int i = 0; i < 2 * F; i++) {
+                p[i] = a;
+                p[2 * F + i] = b;
+            }
+        }
+#endif
+    }
+};
+
+#endif /* SCALER_H */
@@ -1,4 +1,8 @@
+#ifndef STELLA_H
+#define STELLA_H
+
 #include <cinttypes>
+#include <string>
 #include <unordered_map>
 
 namespace Stella
@@ -60,6 +64,7 @@ namespace Stella
 
         VSYNC_SET = 0x02,
         VBLANK_ENABLED = 0x02,
+        VBLANK_DUMP_PADDLES = 0x80,
 
         REFP_REFLECT = 0x08,
 
@@ -110,6 +115,11 @@ namespace Stella
         SWCHA_JOYSTICK1_RIGHT = 0x08,
         INPT5_JOYSTICK1_BUTTON = 0x80,
 
+        SWCHA_PADDLE0_BUTTON = 0x80,
+        SWCHA_PADDLE1_BUTTON = 0x40,
+        SWCHA_PADDLE2_BUTTON = 0x08,
+        SWCHA_PADDLE3_BUTTON = 0x04,
+
         SWCHB_RESET_SWITCH = 0x01,
         SWCHB_SELECT_SWITCH = 0x02,
         SWCHB_TVTYPE_SWITCH = 0x08,
@@ -117,16 +127,69 @@ namespace Stella
         SWCHB_P1_DIFFICULTY_SWITCH = 0x80,
     };
 
-    static constexpr uint32_t vsync_lines = 3;
-    static constexpr uint32_t vblank_lines = 37;
-    // static constexpr uint32_t visible_line_start = (vsync_lines + vblank_lines);
-    static constexpr uint32_t visible_lines = 192;
-    static constexpr uint32_t overscan_lines = 30;
-    static constexpr uint32_t lines_per_frame = (vsync_lines + vblank_lines + visible_lines + overscan_lines);
     static constexpr uint32_t hblank_pixels = 68;
     static constexpr uint32_t visible_pixels = 160;
     static constexpr uint32_t clocks_per_line = (hblank_pixels + visible_pixels);
-    // static constexpr uint32_t clocks_per_frame = lines_per_frame * clocks_per_line;
+
+    // Part of a frame, in clocks from the start of a line and in lines
+    // from the end of VSYNC
+    struct frame_area
+    {
+        uint32_t left, top, width, height;
+    };
+
+    // TV standards differ in lines per frame and clock rate; the machine
+    // takes one of these as a template parameter so both are constants
+    // wherever emulation uses them.  The standard also picks the palette.
+    enum standard { NTSC, PAL, SECAM };
+
+    struct NTSC_timing
+    {
+        static constexpr standard tv_standard = NTSC;
+        static constexpr uint32_t vsync_lines = 3;
+        static constexpr uint32_t vblank_lines = 37;
+        static constexpr uint32_t visible_lines = 192;
+        static constexpr uint32_t overscan_lines = 30;
+        static constexpr uint32_t lines_per_frame = (vsync_lines + vblank_lines + visible_lines + overscan_lines);
+        static constexpr uint32_t clocks_per_frame = lines_per_frame * clocks_per_line;
+        static constexpr frame_area visible_area = {hblank_pixels, vblank_lines, visible_pixels, visible_lines};
+        static constexpr uint64_t clock_rate = 3579540;
+        static constexpr double frame_rate = (double)clock_rate / clocks_per_frame;
+    };
+
+    struct PAL_timing
+    {
+        static constexpr standard tv_standard = PAL;
+        static constexpr uint32_t vsync_lines = 3;
+        static constexpr uint32_t vblank_lines = 45;
+        static constexpr uint32_t visible_lines = 228;
+        static constexpr uint32_t overscan_lines = 36;
+        static constexpr uint32_t lines_per_frame = (vsync_lines + vblank_lines + visible_lines + overscan_lines);
+        static constexpr uint32_t clocks_per_frame = lines_per_frame * clocks_per_line;
+        static constexpr frame_area visible_area = {hblank_pixels, vblank_lines, visible_pixels, visible_lines};
+        static constexpr uint64_t clock_rate = 3546894;
+        static constexpr double frame_rate = (double)clock_rate / clocks_per_frame;
+    };
+
+    // PAL's frame with a slightly faster clock
+    struct SECAM_timing : PAL_timing
+    {
+        static constexpr standard tv_standard = SECAM;
+        static constexpr uint64_t clock_rate = 3562500;
+        static constexpr double frame_rate = (double)clock_rate / clocks_per_frame;
+    };
+
+    // Frames end at VSYNC, so kernels can draw a few more or fewer lines
+    // than their standard; this bounds a frame that never sees VSYNC
+    static constexpr uint32_t max_lines_per_frame = 320;
+
+    // Each paddle's pot charges a capacitor once VBLANK stops dumping it,
+    // and INPT0-3 bit 7 sets when the capacitor reaches the TIA's input
+    // threshold; a full-scale pot takes about 380 lines, as on hardware
+    static constexpr double paddle_series_ohms = 1.8e3;
+    static constexpr double paddle_pot_ohms = 1.0e6;
+    static constexpr double paddle_capacitance = 68e-9;
+    static constexpr double paddle_threshold = 0.3; // fraction of supply
 
     int get_signed_move(uint8_t HM)
     {
@@ -186,3 +249,4 @@ namespace Stella
     };
 };
 
+#endif /* STELLA_H */
@@ -0,0 +1,169 @@
+/*
+    Starpath Supercharger ("AR") cartridge with instant multi-load
+
+    Image files are a sequence of 8448-byte loads as captured from
+    tape, each 8192 bytes of pages followed by a 256-byte header:
+        0-1     start address, low then high
+        2       bank configuration byte to use when starting the load
+        3       number of pages in the load
+        4       header checksum
+        5       load number
+        16-47   destination of each page, bits 0-1 bank, bits 2-4 page
+        64-95   page checksums
+
+    The tape is never played.  In place of the real BIOS we put a
+    small stub in the ROM bank which reads the hotspot at $F850; that
+    read copies the requested load straight into the 6K of RAM,
+    and the stub then applies the load's bank configuration and jumps
+    to its start address, exactly as the real BIOS ends a load.
+
+    Games request another load by storing its number in $FA and
+    jumping to $F800 with the ROM bank selected.
+*/
+
+#ifndef SUPERCHARGER_H
+#define SUPERCHARGER_H
+
+#include <cstdio>
+#include <cstring>
+#include <array>
+#include <vector>
+
+struct supercharger
+{
+    static constexpr size_t load_size = 8448;
+    static constexpr size_t load_header_offset = 8192;
+    static constexpr uint32_t bank_size = 2048;
+    static constexpr uint32_t ROM_offset = 3 * bank_size;
+    static constexpr uint16_t load_hotspot = 0xF850;
+    static constexpr uint16_t config_hotspot = 0xFFF8;
+
+    std::vector<uint8_t> loads;
+    std::array<uint8_t, 4 * bank_size> image; // 3 RAM banks and then the BIOS stub
+    uint32_t slot_offset[2];
+    bool write_enabled = false;
+    bool load_failed = false; // a requested load wasn't in the image
+
+    uint8_t data_hold = 0;
+    bool write_pending = false;
+    uint64_t data_hold_access = 0;
+
+    void insert(const std::vector<uint8_t>& contents)
+    {
+        loads = contents;
+        image.fill(0);
+        create_bios(loads[load_header_offset + 5]);
+        configure(0);
+    }
+
+    void create_bios(uint8_t first_load)
+    {
+        static const uint8_t stub[] = {
+            0xA5, 0xFA,             // F800 LDA $FA     ; multi-load entry, game placed load number in $FA
+            0x85, 0x80,             // F802 STA $80
+            0x4C, 0x10, 0xF8,       // F804 JMP $F810
+            0xEA, 0xEA, 0xEA,       // F807 NOP x 3
+            0x78,                   // F80A SEI         ; power-on entry
+            0xD8,                   // F80B CLD
+            0xA9, 0x00,             // F80C LDA #first  ; patched with first load number
+            0x85, 0x80,             // F80E STA $80
+            0xA2, 0xFF,             // F810 LDX #$FF
+            0x9A,                   // F812 TXS
+            0xAD, 0x50, 0xF8,       // F813 LDA $F850   ; hotspot, load $80 and leave config in $80
+            0xA2, 0x03,             // F816 LDX #3
+            0xBD, 0x28, 0xF8,       // F818 LDA $F828,X ; copy "CMP $FFF8 ; JMP" ahead of start address in $FE
+            0x95, 0xFA,             // F81B STA $FA,X
+            0xCA,                   // F81D DEX
+            0x10, 0xF8,             // F81E BPL $F818
+            0xA6, 0x80,             // F820 LDX $80
+            0xDD, 0x00, 0xF0,       // F822 CMP $F000,X ; latch config in data hold register
+            0x4C, 0xFA, 0x00,       // F825 JMP $00FA
+            0xCD, 0xF8, 0xFF, 0x4C, // F828 CMP $FFF8 ; JMP
+        };
+        uint8_t *bios = image.data() + ROM_offset;
+        memcpy(bios, stub, sizeof(stub));
+        bios[0x0D] = first_load;
+        for(int vector = 0x7FA; vector < 0x800; vector += 2) {
+            bios[vector + 0] = 0x0A;
+            bios[vector + 1] = 0xF8;
+        }
+    }
+
+    void configure(uint8_t config)
+    {
+        static constexpr uint32_t configurations[8][2] = {
+            {2 * bank_size, ROM_offset},
+            {0 * bank_size, ROM_offset},
+            {2 * bank_size, 0 * bank_size},
+            {0 * bank_size, 2 * bank_size},
+            {2 * bank_size, ROM_offset},
+            {1 * bank_size, ROM_offset},
+            {2 * bank_size, 1 * bank_size},
+            {1 * bank_size, 2 * bank_size},
+        };
+        slot_offset[0] = configurations[(config >> 2) & 0x7][0];
+        slot_offset[1] = configurations[(config >> 2) & 0x7][1];
+        // Bit 0 powers the ROM down to save battery; the stub stays readable
+        write_enabled = config & 0x02;
+    }
+
+    void load(uint8_t number, std::array<uint8_t, 128>& RAM)
+    {
+        for(size_t base = 0; base + load_size <= loads.size(); base += load_size) {
+            const uint8_t *header = loads.data() + base + load_header_offset;
+            if(header[5] != number) {
+                continue;
+            }
+            for(int page = 0; page < header[3]; page++) {
+                uint32_t bank = header[16 + page] & 0x03;
+                uint32_t bank_page = (header[16 + page] >> 2) & 0x07;
+                if(bank < 3) {
+                    memcpy(image.data() + bank * bank_size + bank_page * 256, loads.data() + base + page * 256, 256);
+                }
+            }
+            // Where the BIOS would leave the config byte and start address
+            RAM[0x80 & 0x7F] = header[2];
+            RAM[0xFE & 0x7F] = header[0];
+            RAM[0xFF & 0x7F] = header[1];
+            return;
+        }
+        fprintf(stderr, "supercharger load %d not found in image\n", number);
+        load_failed = true;
+    }
+
+    // Every cartridge access goes through here.  Our CPU skips the
+    // 6502's dummy reads, so "distinct" accesses, counted by the bus as
+    // changes of address, line up with the real cart's 5-access write.
+    uint8_t access(uint16_t addr, uint64_t distinct_accesses, std::array<uint8_t, 128>& RAM)
+    {
+        bool ROM_in_slot1 = slot_offset[1] == ROM_offset;
+
+        if((addr == load_hotspot) && ROM_in_slot1) {
+            load(RAM[0x80 & 0x7F], RAM);
+        } else {
+            if(write_pending && (distinct_accesses > data_hold_access + 5)) {
+                write_pending = false;
+            }
+
+            if(((addr & 0x0F00) == 0) && (!write_enabled || !write_pending)) {
+                data_hold = addr & 0xFF;
+                data_hold_access = distinct_accesses;
+                write_pending = true;
+            } else if(addr == config_hotspot) {
+                write_pending = false;
+                configure(data_hold);
+            } else if(write_enabled && write_pending && (distinct_accesses == data_hold_access + 5)) {
+                if((addr & 0x0800) == 0) {
+                    image[(addr & 0x07FF) + slot_offset[0]] = data_hold;
+                } else if(!ROM_in_slot1) {
+                    image[(addr & 0x07FF) + slot_offset[1]] = data_hold;
+                }
+                write_pending = false;
+            }
+        }
+
+        return image[(addr & 0x07FF) + slot_offset[(addr & 0x0800) ? 1 : 0]];
+    }
+};
+
+#endif /* SUPERCHARGER_H */
@@ -0,0 +1,656 @@
+/*
+    TIA audio engine shared by the emulator and trace_to_pcm
+
+    Public methods:
+        set_rates(clock_rate, sample_rate) - input video clock rate and output sample rate
+        write(reg, value, clock) - write AUDC0..AUDV1 at a video clock
+        advance_to_clock(clock) - run both channels up to a video clock
+        samples_available() - stereo samples ready to read
+        read_samples(out, count) - read stereo U8, S16, or float samples,
+            interleaved
+        render(count, out) - run forward from the current clock until
+            count stereo samples are ready, and read them
+        save() - keyframe of channel state at the current clock
+        restore(keyframe) - continue from a keyframe, with output lined
+            up with the samples an uninterrupted run would produce
+        skip_to(clock) - continue from a later clock as if no time had
+            passed, e.g. after a seek, without rendering the gap
+
+    Clocks are video (pixel) clocks and must not go backwards.
+*/
+
+#ifndef TIA_AUDIO_H
+#define TIA_AUDIO_H
+
+#include <algorithm>
+#include <cstring>
+#include <cinttypes>
+#include <vector>
+
+#include "stella.h"
+#include "band_limited.h"
+
+struct TIAAudioChannel
+{
+    int sound_bit = 0;
+    uint16_t poly4 = 0xff;
+    uint16_t poly5 = 0xff;
+    uint16_t poly9 = 0xff;
+    int tone31Counter = 31;
+    int tone6Counter = 3;
+    int tone6 = 1;
+    int tone2 = 1;
+
+    int currentPoly4()
+    {
+        return poly4 & 0x1;
+    }
+
+    int nextPoly4()
+    {
+        int oldbit = poly4 & 0x1;
+        int newbit = ((poly4 >> 1) ^ oldbit) & 0x1;
+        poly4 = (poly4 >> 1) | (newbit << 3);
+        return oldbit;
+    }
+
+    int nextPoly5()
+    {
+        int oldbit = poly5 & 0x1;
+        int newbit = ((poly5 >> 2) ^ oldbit) & 0x1;
+        poly5 = (poly5 >> 1) | (newbit << 4);
+        return oldbit;
+    }
+
+    int nextPoly9()
+    {
+        int oldbit = poly9 & 0x1;
+        int newbit = ((poly9 >> 4) ^ oldbit) & 0x1;
+        poly9 = (poly9 >> 1) | (newbit << 8);
+        return oldbit;
+    }
+
+    int nextTone2()
+    {
+        int bit = tone2;
+        tone2 = tone2 ^ 0x1;
+        return bit;
+    }
+
+    int currentTone6()
+    {
+        return tone6;
+    }
+
+    int nextTone6()
+    {
+        if(tone6Counter > 0) {
+            tone6Counter--;
+        } else {
+            tone6Counter = 3;
+            tone6 ^= 0x1;
+        }
+        return tone6;
+    }
+
+    int currentTone31()
+    {
+        // change this in nextTone31
+        return (tone31Counter > 13) ? 1 : 0;
+    }
+
+    int nextTone31()
+    {
+        if(tone31Counter > 0) {
+            tone31Counter--;
+        } else {
+            tone31Counter = 31;
+        }
+        return currentTone31();
+    }
+
+    int advance_audio_clock(uint8_t AUDC)
+    {
+        switch(AUDC & 0xF) {
+            case 0x0: case 0xb: default:
+                return 1;
+            case 0x1:
+                return nextPoly4();
+            case 0x2:
+                return (currentTone31() != nextTone31()) ? nextPoly4() : currentPoly4();
+            case 0x3:
+                return (nextPoly5() == 1) ? nextPoly4() : currentPoly4();
+            case 0x4: case 0x5:
+                return nextTone2();
+            case 0x6: case 0xa:
+                return nextTone31();
+            case 0x7: case 0x9:
+                return nextPoly5();
+            case 0x8:
+                return nextPoly9();
+            case 0xc: case 0xd:
+                return nextTone6();
+            case 0xe:
+                return (currentTone31() != nextTone31()) ? nextTone6() : currentTone6();
+            case 0xf:
+                return (nextPoly5() == 1) ? nextTone6() : currentTone6();
+        }
+    }
+
+    // Returns signed level, full scale at AUDV 15
+    int advance_clock(uint8_t AUDV, uint8_t AUDF, uint8_t AUDC, int& counter)
+    {
+        // Does writing new AUDF reset the counter?  Or is it only used to reload the counter?
+        if(counter > 0) {
+            counter--;
+        } else {
+            sound_bit = advance_audio_clock(AUDC);
+            counter = AUDF & 0x1F;
+        }
+
+        return (sound_bit ? -128 : 127) * (AUDV & 0xF) / 15;
+    }
+};
+
+// Each AUDC mode is a small state machine over only the channel
+// variables it uses (e.g. just poly9 for mode 8, poly5 and poly4 for
+// mode 3), so every mode's output is precomputed around each cycle of
+// its states.  A run of bits for a fixed AUDC is then a copy out of the
+// cycle, starting at the channel's phase in it.
+struct TIAAudioSequences
+{
+    static constexpr int max_states = 512;
+    static constexpr size_t min_copy = 1024;
+
+    struct cycle
+    {
+        size_t period;
+        std::vector<uint8_t> bits; // repeated out past min_copy so copies rarely wrap
+        std::vector<uint16_t> states; // state before bits[phase]
+    };
+
+    struct mode
+    {
+        int state_count;
+        uint16_t next[max_states];
+        uint8_t bit[max_states];
+        int16_t cycle_of[max_states]; // -1 if state only leads into a cycle
+        uint16_t phase_of[max_states];
+        std::vector<cycle> cycles;
+    };
+
+    mode modes[16];
+
+    static int state_count(uint8_t AUDC)
+    {
+        switch(AUDC & 0xF) {
+            case 0x0: case 0xb: default:
+                return 1;
+            case 0x1:
+                return 16;
+            case 0x2: case 0x3: case 0x8:
+                return 512;
+            case 0x4: case 0x5:
+                return 2;
+            case 0x6: case 0xa: case 0x7: case 0x9:
+                return 32;
+            case 0xc: case 0xd:
+                return 8;
+            case 0xe: case 0xf:
+                return 256;
+        }
+    }
+
+    // -1 until poly4 and poly5 have shifted out their power-on 0xff
+    static int state_of(uint8_t AUDC, const TIAAudioChannel& c)
+    {
+        int tone6 = c.tone6Counter * 2 + c.tone6;
+        switch(AUDC & 0xF) {
+            case 0x0: case 0xb: default:
+                return 0;
+            case 0x1:
+                return (c.poly4 < 16) ? c.poly4 : -1;
+            case 0x2:
+                return (c.poly4 < 16) ? (c.tone31Counter * 16 + c.poly4) : -1;
+            case 0x3:
+                return ((c.poly4 < 16) && (c.poly5 < 32)) ? (c.poly5 * 16 + c.poly4) : -1;
+            case 0x4: case 0x5:
+                return c.tone2;
+            case 0x6: case 0xa:
+                return c.tone31Counter;
+            case 0x7: case 0x9:
+                return (c.poly5 < 32) ? c.poly5 : -1;
+            case 0x8:
+                return c.poly9;
+            case 0xc: case 0xd:
+                return tone6;
+            case 0xe:
+                return c.tone31Counter * 8 + tone6;
+            case 0xf:
+                return (c.poly5 < 32) ? (c.poly5 * 8 + tone6) : -1;
+        }
+    }
+
+    static void set_state(uint8_t AUDC, int state, TIAAudioChannel& c)
+    {
+        switch(AUDC & 0xF) {
+            case 0x0: case 0xb: default:
+                break;
+            case 0x1:
+                c.poly4 = state;
+                break;
+            case 0x2:
+                c.tone31Counter = state / 16;
+                c.poly4 = state % 16;
+                break;
+            case 0x3:
+                c.poly5 = state / 16;
+                c.poly4 = state % 16;
+                break;
+            case 0x4: case 0x5:
+                c.tone2 = state;
+                break;
+            case 0x6: case 0xa:
+                c.tone31Counter = state;
+                break;
+            case 0x7: case 0x9:
+                c.poly5 = state;
+                break;
+            case 0x8:
+                c.poly9 = state;
+                break;
+            case 0xc: case 0xd:
+                c.tone6Counter = state / 2;
+                c.tone6 = state % 2;
+                break;
+            case 0xe:
+                c.tone31Counter = state / 8;
+                c.tone6Counter = state % 8 / 2;
+                c.tone6 = state % 2;
+                break;
+            case 0xf:
+                c.poly5 = state / 8;
+                c.tone6Counter = state % 8 / 2;
+                c.tone6 = state % 2;
+                break;
+        }
+    }
+
+    TIAAudioSequences()
+    {
+        for(int AUDC = 0; AUDC < 16; AUDC++) {
+            mode& m = modes[AUDC];
+            m.state_count = state_count(AUDC);
+            for(int state = 0; state < m.state_count; state++) {
+                TIAAudioChannel c;
+                set_state(AUDC, state, c);
+                m.bit[state] = c.advance_audio_clock(AUDC);
+                m.next[state] = state_of(AUDC, c);
+                m.cycle_of[state] = -1;
+            }
+
+            // Walk from every state until reaching one already seen; if it
+            // was seen on this walk, the walk closed a new cycle
+            std::vector<int> walked(m.state_count, -1);
+            for(int start = 0; start < m.state_count; start++) {
+                int state = start;
+                while(walked[state] == -1) {
+                    walked[state] = start;
+                    state = m.next[state];
+                }
+                if(walked[state] != start) {
+                    continue;
+                }
+                cycle cy;
+                int first = state;
+                do {
+                    m.cycle_of[state] = m.cycles.size();
+                    m.phase_of[state] = cy.states.size();
+                    cy.states.push_back(state);
+                    state = m.next[state];
+                } while(state != first);
+                cy.period = cy.states.size();
+                while(cy.bits.size() < min_copy + cy.period) {
+                    for(int s: cy.states) {
+                        cy.bits.push_back(m.bit[s]);
+                    }
+                }
+                m.cycles.push_back(cy);
+            }
+        }
+    }
+
+    static const TIAAudioSequences& get()
+    {
+        static const TIAAudioSequences sequences;
+        return sequences;
+    }
+
+    // Same as count calls to c.advance_audio_clock(AUDC)
+    void generate(TIAAudioChannel& c, uint8_t AUDC, size_t count, uint8_t *bits) const
+    {
+        int state = state_of(AUDC, c);
+        for(; (count > 0) && (state < 0); count--) {
+            *bits++ = c.advance_audio_clock(AUDC);
+            state = state_of(AUDC, c);
+        }
+        if(count == 0) {
+            return;
+        }
+
+        const mode& m = modes[AUDC & 0xF];
+        for(; (count > 0) && (m.cycle_of[state] < 0); count--) {
+            *bits++ = m.bit[state];
+            state = m.next[state];
+        }
+
+        const cycle& cy = m.cycles[m.cycle_of[state]];
+        size_t phase = m.phase_of[state];
+        while(count > 0) {
+            size_t n = std::min(count, cy.bits.size() - phase);
+            memcpy(bits, cy.bits.data() + phase, n);
+            bits += n;
+            count -= n;
+            phase = (phase + n) % cy.period;
+        }
+        set_state(AUDC, cy.states[phase], c);
+    }
+};
+
+struct TIAAudio
+{
+    typedef uint64_t clk_t;
+    static constexpr clk_t video_clocks_per_audio_clock = 114;
+
+    uint8_t AUDC[2] = {0, 0};
+    uint8_t AUDF[2] = {0, 0};
+    uint8_t AUDV[2] = {0, 0};
+
+    int volume_percent = 100;
+
+    TIAAudioChannel channels[2];
+    int counters[2] = {0, 0};
+    int levels[2] = {0, 0}; // before volume_percent
+    band_limited_synth synth[2];
+
+    clk_t clock_rate = 3579540;
+    clk_t next_audio_clock = 0;
+    clk_t frame_start_clock = 0;
+
+    void set_rates(clk_t clock_rate_, uint32_t sample_rate)
+    {
+        clock_rate = clock_rate_;
+        synth[0].set_rates(clock_rate, sample_rate);
+        synth[1].set_rates(clock_rate, sample_rate);
+    }
+
+    void set_sample_rate(double sample_rate)
+    {
+        synth[0].set_sample_rate(clock_rate, sample_rate);
+        synth[1].set_sample_rate(clock_rate, sample_rate);
+    }
+
+    void write(uint8_t reg, uint8_t value, clk_t clock)
+    {
+        advance_to_clock(clock);
+        set_register(reg, value);
+    }
+
+    void set_register(uint8_t reg, uint8_t value)
+    {
+        using namespace Stella;
+        switch(reg) {
+            case AUDC0: AUDC[0] = value; break;
+            case AUDC1: AUDC[1] = value; break;
+            case AUDF0: AUDF[0] = value; break;
+            case AUDF1: AUDF[1] = value; break;
+            case AUDV0: AUDV[0] = value; break;
+            case AUDV1: AUDV[1] = value; break;
+            default: break;
+        }
+    }
+
+    int scaled(int level) const
+    {
+        return level * volume_percent / 100;
+    }
+
+    void set_level(int channel, int level, clk_t clock, bool audible)
+    {
+        if(level != levels[channel]) {
+            if(audible) {
+                synth[channel].add_delta(clock - frame_start_clock, scaled(level) - scaled(levels[channel]));
+            }
+            levels[channel] = level;
+        }
+    }
+
+    // The emulator's per-line calls are two ticks and a bit or two, where
+    // skipping ahead and looking up sequence state cost more than stepping
+    static constexpr clk_t sequence_min_ticks = 16;
+
+    // "ticks" calls to TIAAudioChannel::advance_clock() for each channel
+    // from next_audio_clock
+    void step_channels(clk_t ticks, bool audible)
+    {
+        clk_t clock = next_audio_clock;
+        for(; ticks > 0; ticks--, clock += video_clocks_per_audio_clock) {
+            for(int channel = 0; channel < 2; channel++) {
+                set_level(channel, channels[channel].advance_clock(AUDV[channel], AUDF[channel], AUDC[channel], counters[channel]), clock, audible);
+            }
+        }
+    }
+
+    // Same result as step_channels() for one channel, but skips ticks
+    // where the divider is only counting down and takes runs of new bits
+    // from TIAAudioSequences
+    void advance_channel(int channel, clk_t ticks, bool audible)
+    {
+        TIAAudioChannel& c = channels[channel];
+        int& counter = counters[channel];
+        clk_t period = (AUDF[channel] & 0x1F) + 1;
+        int volume = AUDV[channel] & 0xF;
+        int level_of_bit[2] = {127 * volume / 15, -128 * volume / 15};
+        clk_t clock = next_audio_clock;
+        uint8_t bits[256];
+
+        while(ticks > 0) {
+            if(counter > 0) {
+                // Level is unchanged unless AUDV was just written
+                clk_t skipped = std::min<clk_t>(counter, ticks);
+                set_level(channel, level_of_bit[c.sound_bit], clock, audible);
+                counter -= skipped;
+                ticks -= skipped;
+                clock += skipped * video_clocks_per_audio_clock;
+            } else {
+                // New bit on this tick and every "period" ticks after
+                size_t count = std::min<clk_t>(1 + (ticks - 1) / period, sizeof(bits));
+                TIAAudioSequences::get().generate(c, AUDC[channel], count, bits);
+                for(size_t i = 0; i < count; i++) {
+                    set_level(channel, level_of_bit[bits[i]], clock + i * period * video_clocks_per_audio_clock, audible);
+                }
+                c.sound_bit = bits[count - 1];
+                counter = period - 1;
+                clk_t used = (count - 1) * period + 1;
+                ticks -= used;
+                clock += used * video_clocks_per_audio_clock;
+            }
+        }
+    }
+
+    void advance_to_clock(clk_t until)
+    {
+        if(next_audio_clock < until) {
+            clk_t ticks = (until - next_audio_clock + video_clocks_per_audio_clock - 1) / video_clocks_per_audio_clock;
+            if(ticks < sequence_min_ticks) {
+                step_channels(ticks, true);
+            } else {
+                advance_channel(0, ticks, true);
+                advance_channel(1, ticks, true);
+            }
+            next_audio_clock += ticks * video_clocks_per_audio_clock;
+        }
+        synth[0].end_frame(until - frame_start_clock);
+        synth[1].end_frame(until - frame_start_clock);
+        frame_start_clock = until;
+    }
+
+    // Run the channels without producing audio, e.g. to find keyframes
+    void advance_channels_to_clock(clk_t until)
+    {
+        if(next_audio_clock < until) {
+            clk_t ticks = (until - next_audio_clock + video_clocks_per_audio_clock - 1) / video_clocks_per_audio_clock;
+            if(ticks < sequence_min_ticks) {
+                step_channels(ticks, false);
+            } else {
+                advance_channel(0, ticks, false);
+                advance_channel(1, ticks, false);
+            }
+            next_audio_clock += ticks * video_clocks_per_audio_clock;
+        }
+        frame_start_clock = until;
+    }
+
+    // Everything audio output depends on, from which rendering can
+    // resume.  Serialized as keyframe_size bytes for traces.
+    struct keyframe
+    {
+        clk_t clock;
+        clk_t next_audio_clock;
+        TIAAudioChannel channels[2];
+        int counters[2];
+        int levels[2];
+        uint8_t AUDC[2], AUDF[2], AUDV[2];
+
+        static constexpr size_t keyframe_size = 1 + 2 * 14;
+
+        void encode(uint8_t *p) const
+        {
+            *p++ = next_audio_clock - clock;
+            for(int channel = 0; channel < 2; channel++) {
+                const TIAAudioChannel& c = channels[channel];
+                *p++ = c.sound_bit;
+                *p++ = c.poly4;
+                *p++ = c.poly5;
+                *p++ = c.poly9 & 0xFF;
+                *p++ = c.poly9 >> 8;
+                *p++ = c.tone31Counter;
+                *p++ = c.tone6Counter;
+                *p++ = c.tone6;
+                *p++ = c.tone2;
+                *p++ = counters[channel];
+                *p++ = (uint8_t)(int8_t)levels[channel];
+                *p++ = AUDC[channel];
+                *p++ = AUDF[channel];
+                *p++ = AUDV[channel];
+            }
+        }
+
+        void decode(clk_t clock_, const uint8_t *p)
+        {
+            clock = clock_;
+            next_audio_clock = clock + *p++;
+            for(int channel = 0; channel < 2; channel++) {
+                TIAAudioChannel& c = channels[channel];
+                c.sound_bit = *p++;
+                c.poly4 = *p++;
+                c.poly5 = *p++;
+                c.poly9 = p[0] | (p[1] << 8);
+                p += 2;
+                c.tone31Counter = *p++;
+                c.tone6Counter = *p++;
+                c.tone6 = *p++;
+                c.tone2 = *p++;
+                counters[channel] = *p++;
+                levels[channel] = (int8_t)*p++;
+                AUDC[channel] = *p++;
+                AUDF[channel] = *p++;
+                AUDV[channel] = *p++;
+            }
+        }
+    };
+
+    keyframe save() const
+    {
+        keyframe k;
+        k.clock = frame_start_clock;
+        k.next_audio_clock = next_audio_clock;
+        for(int channel = 0; channel < 2; channel++) {
+            k.channels[channel] = channels[channel];
+            k.counters[channel] = counters[channel];
+            k.levels[channel] = levels[channel];
+            k.AUDC[channel] = AUDC[channel];
+            k.AUDF[channel] = AUDF[channel];
+            k.AUDV[channel] = AUDV[channel];
+        }
+        return k;
+    }
+
+    // Samples within band_limited_synth::taps of sample_index(k.clock)
+    // are missing the tails of steps before the keyframe, so callers
+    // should discard them; every sample after matches an uninterrupted run.
+    void restore(const keyframe& k)
+    {
+        frame_start_clock = k.clock;
+        next_audio_clock = k.next_audio_clock;
+        for(int channel = 0; channel < 2; channel++) {
+            channels[channel] = k.channels[channel];
+            counters[channel] = k.counters[channel];
+            levels[channel] = k.levels[channel];
+            AUDC[channel] = k.AUDC[channel];
+            AUDF[channel] = k.AUDF[channel];
+            AUDV[channel] = k.AUDV[channel];
+            synth[channel].seek(k.clock, scaled(levels[channel]));
+        }
+    }
+
+    // Output carries on from the samples already made; channel state
+    // and the phase of the next audio clock are kept
+    void skip_to(clk_t clock)
+    {
+        next_audio_clock = clock + (next_audio_clock - std::min(next_audio_clock, frame_start_clock));
+        frame_start_clock = clock;
+    }
+
+    // First output sample at or after "clock"
+    uint64_t sample_index(clk_t clock) const
+    {
+        return synth[0].sample_index(clock);
+    }
+
+    size_t samples_available() const
+    {
+        return synth[0].samples_available();
+    }
+
+    void read_samples(uint8_t *out, size_t count)
+    {
+        synth[0].read_samples(out + 0, count, 2, 128);
+        synth[1].read_samples(out + 1, count, 2, 128);
+    }
+
+    void read_samples(int16_t *out, size_t count)
+    {
+        synth[0].read_samples(out + 0, count, 2);
+        synth[1].read_samples(out + 1, count, 2);
+    }
+
+    void read_samples(float *out, size_t count)
+    {
+        synth[0].read_samples(out + 0, count, 2);
+        synth[1].read_samples(out + 1, count, 2);
+    }
+
+    // Runs registers as they are now until count samples are ready
+    void render(size_t count, uint8_t *out)
+    {
+        size_t available = samples_available();
+        if(available < count) {
+            uint64_t needed = ((uint64_t)count << band_limited_synth::fraction_bits) - synth[0].offset;
+            advance_to_clock(frame_start_clock + (needed + synth[0].factor - 1) / synth[0].factor);
+        }
+        read_samples(out, count);
+    }
+};
+
+#endif /* TIA_AUDIO_H */
@@ -0,0 +1,141 @@
+/*
+    Host time tracing
+
+    With --trace, scoped zones around the phases of emulation and
+    presentation record when each started and how long it took, on the
+    thread that ran it, and at exit the trace is written as Chrome
+    trace_event JSON for chrome://tracing or ui.perfetto.dev.  Times
+    are steady_clock nanoseconds from when tracing started; the format
+    counts microseconds, so they're written with three decimals.
+
+    Zones nest, so a zone's self time is whatever its inner zones don't
+    cover.  The per-line ones, audio and WSYNC catch-up, make a few
+    hundred events a frame, so --trace-frames picks which frames to
+    record.  With tracing off a zone is a relaxed load and a branch.
+*/
+
+#ifndef TRACE_EVENT_H
+#define TRACE_EVENT_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cinttypes>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Trace
+{
+    struct event
+    {
+        const char *name; // a string literal
+        int64_t start; // nanoseconds
+        int64_t duration;
+    };
+
+    struct thread_events
+    {
+        std::string name;
+        std::vector<event> events;
+    };
+
+    inline FILE *file = nullptr;
+    inline int64_t origin = 0;
+    inline std::atomic<bool> recording{false};
+    inline std::mutex threads_mutex;
+    inline std::vector<std::unique_ptr<thread_events>> threads; // outlive their threads
+
+    inline int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // The calling thread's events, made the first time it asks
+    inline thread_events& this_thread_events()
+    {
+        thread_local thread_events *mine = nullptr;
+        if(mine == nullptr) {
+            std::scoped_lock lock(threads_mutex);
+            threads.push_back(std::make_unique<thread_events>());
+            mine = threads.back().get();
+            mine->events.reserve(1 << 16);
+        }
+        return *mine;
+    }
+
+    inline void name_thread(const char *name)
+    {
+        if(file) {
+            this_thread_events().name = name;
+        }
+    }
+
+    struct zone
+    {
+        const char *name;
+        int64_t start = 0;
+
+        zone(const char *name_) : name(name_)
+        {
+            if(recording.load(std::memory_order_relaxed)) {
+                start = now();
+            }
+        }
+
+        ~zone()
+        {
+            if(start != 0) {
+                this_thread_events().events.push_back({name, start, now() - start});
+            }
+        }
+    };
+
+    inline bool open(const char *filename)
+    {
+        file = fopen(filename, "w");
+        origin = now();
+        return file != nullptr;
+    }
+
+    inline void write_time(int64_t nanoseconds)
+    {
+        fprintf(file, "%lld.%03lld", (long long)(nanoseconds / 1000), (long long)(nanoseconds % 1000));
+    }
+
+    // Every thread that recorded must be done with its zones
+    inline void close()
+    {
+        if(file == nullptr) {
+            return;
+        }
+        recording = false;
+        size_t count = 0;
+        fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        const char *separator = "";
+        for(size_t tid = 0; tid < threads.size(); tid++) {
+            const thread_events& thread = *threads[tid];
+            if(!thread.name.empty()) {
+                fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}",
+                    separator, tid, thread.name.c_str());
+                separator = ",\n";
+            }
+            for(const event& e : thread.events) {
+                fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":", separator, e.name, tid);
+                write_time(e.start - origin);
+                fprintf(file, ",\"dur\":");
+                write_time(e.duration);
+                fprintf(file, "}");
+                separator = ",\n";
+            }
+            count += thread.events.size();
+        }
+        fprintf(file, "\n]}\n");
+        fclose(file);
+        file = nullptr;
+        fprintf(stderr, "wrote %zu trace events\n", count);
+    }
+};
+
+#endif /* TRACE_EVENT_H */
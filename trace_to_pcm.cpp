@@ -1,7 +1,16 @@
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <cinttypes>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
 
 #include "stella.h"
+#include "tia_audio.h"
+#include "audio_trace.h"
 
 typedef uint64_t clk_t;
 
@@ -47,199 +56,357 @@ component types:
     one tri-state inverter
 */
 
-struct TIAChannel
+static constexpr uint32_t sampling_rate = 44100;
+static constexpr clk_t clock_rate = Stella::NTSC_timing::clock_rate; // text traces don't record one
+
+TIAAudio audio;
+
+// Output is collected and written in large blocks
+static constexpr size_t output_block_size = 1 << 20;
+std::vector<uint8_t> output;
+
+void flush_samples()
 {
-    int sound_bit = 0;
-    uint16_t poly4 = 0xff;
-    uint16_t poly5 = 0xff;
-    uint16_t poly9 = 0xff;
-    int tone31Counter = 31;
-    int tone6Counter = 3;
-    int tone6 = 1;
-    int tone2 = 1;
-
-    uint8_t advance_clock(uint8_t AUDV, uint8_t AUDF, uint8_t AUDC, int& counter);
-    uint8_t advance_audio_clock(uint8_t AUDC);
-
-    int currentPoly4()
-    {
-        return poly4 & 0x1;
-    }
+    fwrite(output.data(), 1, output.size(), stdout);
+    output.clear();
+}
 
-    int nextPoly4()
-    {
-        int oldbit = poly4 & 0x1;
-        int newbit = ((poly4 >> 1) ^ oldbit) & 0x1;
-        poly4 = (poly4 >> 1) | (newbit << 3);
-        return oldbit;
+void emit_samples()
+{
+    size_t count = audio.samples_available();
+    size_t previous_size = output.size();
+    output.resize(previous_size + count * 2);
+    audio.read_samples(output.data() + previous_size, count);
+    if(output.size() >= output_block_size) {
+        flush_samples();
     }
+}
 
-    int nextPoly5()
-    {
-        int oldbit = poly5 & 0x1;
-        int newbit = ((poly5 >> 2) ^ oldbit) & 0x1;
-        poly5 = (poly5 >> 1) | (newbit << 4);
-        return oldbit;
-    }
+// Checksum of benchmark(1); update it only when the audio engine's
+// output is meant to change
+static constexpr uint32_t expected_benchmark_checksum = 0x670D9343;
 
-    int nextPoly9()
-    {
-        int oldbit = poly9 & 0x1;
-        int newbit = ((poly9 >> 4) ^ oldbit) & 0x1;
-        poly9 = (poly9 >> 1) | (newbit << 8);
-        return oldbit;
+// Render every AUDC, with AUDF stepping by 3 and both AUDV levels
+// fixed, through the batch API and report throughput and a checksum of
+// the output.  Returns false if a 1-second run's checksum isn't the
+// expected one.
+bool benchmark(int seconds_per_setting)
+{
+    using namespace Stella;
+
+    std::vector<uint8_t> samples(sampling_rate * 2 / 100);
+    uint32_t checksum = 0;
+    uint64_t total = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for(int audc = 0; audc < 16; audc++) {
+        for(int audf = 0; audf < 32; audf += 3) {
+            audio.write(AUDC0, audc, audio.frame_start_clock);
+            audio.write(AUDC1, 15 - audc, audio.frame_start_clock);
+            audio.write(AUDF0, audf, audio.frame_start_clock);
+            audio.write(AUDF1, 31 - audf, audio.frame_start_clock);
+            audio.write(AUDV0, 15, audio.frame_start_clock);
+            audio.write(AUDV1, 8, audio.frame_start_clock);
+            for(int chunk = 0; chunk < seconds_per_setting * 100; chunk++) {
+                audio.render(samples.size() / 2, samples.data());
+                for(uint8_t s: samples) {
+                    checksum = checksum * 31 + s;
+                }
+                total += samples.size() / 2;
+            }
+        }
     }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
 
-    int nextTone2()
-    {
-        int bit = tone2;
-        tone2 = tone2 ^ 0x1;
-        return bit;
+    fprintf(stderr, "%llu samples in %f seconds, %.0f samples per second, checksum %08X\n",
+        (unsigned long long)total, elapsed.count(), total / elapsed.count(), checksum);
+
+    if((seconds_per_setting == 1) && (checksum != expected_benchmark_checksum)) {
+        fprintf(stderr, "checksum should be %08X; audio output changed\n", expected_benchmark_checksum);
+        return false;
     }
+    return true;
+}
 
-    int currentTone6()
-    {
-        return tone6;
+// A minute of pseudo-random register writes with a keyframe every
+// second, ending in keyframes after the last write, so "make check"
+// can compare serial and parallel rendering of it
+bool write_test_trace(const char *filename)
+{
+    using namespace Stella;
+    static constexpr uint8_t registers[6] = {AUDC0, AUDC1, AUDF0, AUDF1, AUDV0, AUDV1};
+
+    audio_trace_writer writer;
+    if(!writer.open(filename, clock_rate)) {
+        return false;
     }
+    TIAAudio state;
+    uint8_t payload[TIAAudio::keyframe::keyframe_size];
+    auto write_keyframe = [&](clk_t clock) {
+        state.advance_channels_to_clock(clock);
+        state.save().encode(payload);
+        writer.write_payload(clock, AudioTrace::KEYFRAME, payload, sizeof(payload));
+    };
 
-    int nextTone6()
-    {
-        if(tone6Counter > 0) {
-            tone6Counter--;
-        } else {
-            tone6Counter = 3;
-            tone6 ^= 0x1;
+    uint32_t random = 1;
+    clk_t clock = 0;
+    clk_t next_keyframe = clock_rate;
+    while(clock < clock_rate * 60) {
+        random = random * 1103515245 + 12345;
+        clock += (random >> 16) % 20000;
+        if(clock >= next_keyframe) {
+            write_keyframe(clock);
+            next_keyframe += clock_rate;
         }
-        return tone6;
+        uint8_t reg = registers[(random >> 8) % 6];
+        uint8_t value = random >> 24;
+        state.advance_channels_to_clock(clock);
+        state.set_register(reg, value);
+        writer.write(clock, reg, value);
+    }
+    for(int i = 1; i <= 3; i++) {
+        write_keyframe(clock + i * clock_rate);
     }
+    fclose(writer.file);
+    return true;
+}
 
-    int currentTone31()
-    {
-        // change this in nextTone31
-        return (tone31Counter > 13) ? 1 : 0;
+// Where a chunk of a binary trace starts rendering: the audio state at
+// a clock and the trace positioned at the first record after it
+struct chunk_start
+{
+    audio_trace_reader trace;
+    TIAAudio::keyframe state;
+};
+
+// Uses the trace's KEYFRAME records if it has any, otherwise runs just
+// the channels through the trace to make keyframes
+std::vector<chunk_start> find_chunk_starts(const audio_trace_reader& trace, clk_t interval)
+{
+    clk_t record_clock;
+    uint8_t reg;
+    uint8_t value;
+
+    bool has_keyframes = false;
+    audio_trace_reader scan = trace;
+    while(!has_keyframes && scan.next(record_clock, reg, value)) {
+        has_keyframes = (reg == AudioTrace::KEYFRAME);
     }
 
-    int nextTone31()
-    {
-        if(tone31Counter > 0) { 
-            tone31Counter--;
-        } else {
-            tone31Counter = 31;
+    std::vector<chunk_start> starts;
+    TIAAudio state;
+    starts.push_back({trace, state.save()});
+
+    clk_t next_start = interval;
+    scan = trace;
+    audio_trace_reader before_record = scan;
+    while(scan.next(record_clock, reg, value)) {
+        if(has_keyframes) {
+            if((reg == AudioTrace::KEYFRAME) && (value == TIAAudio::keyframe::keyframe_size) && (record_clock >= next_start)) {
+                TIAAudio::keyframe k;
+                k.decode(record_clock, scan.payload);
+                starts.push_back({scan, k});
+                next_start = record_clock + interval;
+            }
+        } else if(reg < 0x80) {
+            if(record_clock >= next_start) {
+                state.advance_channels_to_clock(record_clock);
+                starts.push_back({before_record, state.save()});
+                next_start = record_clock + interval;
+            }
+            state.advance_channels_to_clock(record_clock);
+            state.set_register(reg, value);
         }
-        return currentTone31();
+        before_record = scan;
     }
-};
+    return starts;
+}
 
-uint8_t TIAChannel::advance_audio_clock(uint8_t AUDC)
+// Samples for [first_sample, end_sample) from a chunk start.  Samples
+// within the resampler's width after the keyframe are missing earlier
+// steps, so first_sample must be at least sample_index(state.clock + lead_clocks).
+void render_chunk(const chunk_start& start, clk_t end_clock, uint64_t first_sample, uint64_t end_sample, std::vector<uint8_t>& out)
 {
-    switch(AUDC & 0xF) {
-        case 0x0: case 0xb: default:
-            return 1;
-            break;
-        case 0x1:
-            return nextPoly4();
-            break;
-        case 0x2:
-            return (currentTone31() != nextTone31()) ? nextPoly4() : currentPoly4();
-            break;
-        case 0x3:
-            return (nextPoly5() == 1) ? nextPoly4() : currentPoly4();
-            break;
-        case 0x4: case 0x5:
-            return nextTone2();
-            break;
-        case 0x6: case 0xa:
-            return nextTone31();
-            break;
-        case 0x7: case 0x9:
-            return nextPoly5();
-            break;
-        case 0x8:
-            return nextPoly9();
-            break;
-        case 0xc: case 0xd:
-            return nextTone6();
-            break;
-        case 0xe:
-            return (currentTone31() != nextTone31()) ? nextTone6() : currentTone6();
-            break;
-        case 0xf:
-            return (nextPoly5() == 1) ? nextTone6() : currentTone6();
-            break;
+    TIAAudio chunk_audio;
+    chunk_audio.set_rates(audio.clock_rate, sampling_rate);
+    chunk_audio.restore(start.state);
+
+    uint64_t sample = chunk_audio.sample_index(start.state.clock);
+    out.resize((end_sample - first_sample) * 2);
+    std::vector<uint8_t> samples;
+
+    auto drain = [&]() {
+        size_t count = chunk_audio.samples_available();
+        samples.resize(count * 2);
+        chunk_audio.read_samples(samples.data(), count);
+        for(size_t i = 0; i < count; i++, sample++) {
+            if((sample >= first_sample) && (sample < end_sample)) {
+                out[(sample - first_sample) * 2 + 0] = samples[i * 2 + 0];
+                out[(sample - first_sample) * 2 + 1] = samples[i * 2 + 1];
+            }
+        }
+    };
+
+    audio_trace_reader trace = start.trace;
+    clk_t record_clock;
+    uint8_t reg;
+    uint8_t value;
+    while(trace.next(record_clock, reg, value) && (record_clock < end_clock)) {
+        if(reg < 0x80) {
+            chunk_audio.write(reg, value, record_clock);
+            if(chunk_audio.samples_available() >= 4096) {
+                drain();
+            }
+        }
     }
+    chunk_audio.advance_to_clock(end_clock);
+    drain();
 }
 
-uint8_t TIAChannel::advance_clock(uint8_t AUDV, uint8_t AUDF, uint8_t AUDC, int& counter)
+// Renders chunks between keyframes on "threads" threads at a time and
+// writes them in order.  Output is identical to rendering serially.
+void render_parallel(const audio_trace_reader& trace, int threads)
 {
-    using namespace Stella;
+    // Enough lead that every step before a keyframe has settled by the
+    // first sample kept
+    const clk_t lead_clocks = (band_limited_synth::taps + 2) * audio.clock_rate / sampling_rate + 1;
 
-    // Does writing new AUDF reset the counter?  Or is it only used to reload the counter?
-    if(counter > 0) {
-        counter--;
-    } else {
-        sound_bit = advance_audio_clock(AUDC);
-        counter = AUDF;
+    std::vector<chunk_start> starts = find_chunk_starts(trace, audio.clock_rate * 10);
+
+    // Serial rendering stops at the last register write, not at any
+    // keyframes after it
+    clk_t last_clock = 0;
+    {
+        audio_trace_reader scan = trace;
+        clk_t record_clock;
+        uint8_t reg;
+        uint8_t value;
+        while(scan.next(record_clock, reg, value)) {
+            if(reg < 0x80) {
+                last_clock = record_clock;
+            }
+        }
     }
 
-    return 128 + (sound_bit ? -128 : 127 ) * AUDV / 15;
+    std::vector<std::vector<uint8_t>> outputs(threads);
+    for(size_t first = 0; first < starts.size(); first += threads) {
+        std::vector<std::thread> workers;
+        for(size_t i = first; (i < first + threads) && (i < starts.size()); i++) {
+            clk_t begin_clock = (i == 0) ? 0 : (starts[i].state.clock + lead_clocks);
+            clk_t end_clock = (i + 1 < starts.size()) ? (starts[i + 1].state.clock + lead_clocks) : last_clock;
+            end_clock = std::min(std::max(end_clock, begin_clock), last_clock);
+            begin_clock = std::min(begin_clock, end_clock);
+            uint64_t first_sample = audio.sample_index(begin_clock);
+            uint64_t end_sample = audio.sample_index(end_clock);
+            workers.emplace_back(render_chunk, std::cref(starts[i]), end_clock, first_sample, end_sample, std::ref(outputs[i - first]));
+        }
+        for(size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+            fwrite(outputs[i].data(), 1, outputs[i].size(), stdout);
+        }
+    }
 }
 
-uint8_t tia_write[64];
-int audio_counter[2] = {0, 0};
-uint64_t next_sample_index = 0;
-uint8_t audio_levels[2] = {128, 128};
-clk_t next_sample_clock = 0;
-uint32_t sampling_rate = 44100;
-clk_t previous_audio_processing_clock = 0;
-clk_t next_audio_clock = 0;
-clk_t clock_rate = 3579540;
-static constexpr clk_t video_clocks_per_audio_clock = 114;
-TIAChannel channels[2];
-
-void emit_samples(uint8_t channel1, uint8_t channel2)
+void usage(const char *progname)
 {
-    // XXX TODO Enqueue and flush using PlatformInterface
-    fwrite(&channel1, 1, 1, stdout);
-    fwrite(&channel2, 1, 1, stdout);
+    fprintf(stderr, "usage: %s [--timing] [--threads N] [binary-trace-file] > samples.pcm_u8_2\n", progname);
+    fprintf(stderr, "       %s [--timing] < text-trace.txt > samples.pcm_u8_2\n", progname);
+    fprintf(stderr, "       %s --benchmark [seconds-per-setting]\n", progname);
+    fprintf(stderr, "       %s --write-test-trace binary-trace-file\n", progname);
 }
 
-void advance_audio_clock()
+int main(int argc, const char **argv)
 {
-    using namespace Stella;
-    clk_t current_audio_processing_clock = previous_audio_processing_clock + 1;
+    const char *progname = argv[0];
+    argc--;
+    argv++;
 
-    // fprintf(stderr, "%llu, %llu, %llu\n", current_audio_processing_clock, next_audio_clock, next_sample_clock);
+    bool timing = false;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
 
-    if(next_audio_clock < current_audio_processing_clock) {
-        audio_levels[0] = channels[0].advance_clock(tia_write[AUDV0], tia_write[AUDF0], tia_write[AUDC0], audio_counter[0]);
-        audio_levels[1] = channels[1].advance_clock(tia_write[AUDV1], tia_write[AUDF1], tia_write[AUDC1], audio_counter[1]);
-        next_audio_clock = current_audio_processing_clock + video_clocks_per_audio_clock;
-    }
+    audio.set_rates(clock_rate, sampling_rate);
 
-    if(next_sample_clock < current_audio_processing_clock) {
-        emit_samples(audio_levels[0], audio_levels[1]);
-        next_sample_index ++;
-        next_sample_clock = next_sample_index * clock_rate / sampling_rate;
+    while((argc > 0) && (argv[0][0] == '-')) {
+        if(strcmp(argv[0], "--benchmark") == 0) {
+            bool passed = benchmark((argc > 1) ? atoi(argv[1]) : 1);
+            exit(passed ? EXIT_SUCCESS : EXIT_FAILURE);
+        } else if((strcmp(argv[0], "--write-test-trace") == 0) && (argc > 1)) {
+            if(!write_test_trace(argv[1])) {
+                fprintf(stderr, "couldn't open %s for writing\n", argv[1]);
+                exit(EXIT_FAILURE);
+            }
+            exit(EXIT_SUCCESS);
+        } else if((strcmp(argv[0], "--threads") == 0) && (argc > 1)) {
+            threads = std::max(1, atoi(argv[1]));
+            argc -= 2;
+            argv += 2;
+        } else if(strcmp(argv[0], "--timing") == 0) {
+            timing = true;
+            argc--;
+            argv++;
+        } else {
+            usage(progname);
+            exit(EXIT_FAILURE);
+        }
     }
 
-    previous_audio_processing_clock = current_audio_processing_clock;
-}
+    output.reserve(output_block_size + sampling_rate * 2);
+    auto start = std::chrono::steady_clock::now();
+    size_t trace_bytes = 0;
 
+    if(argc > 0) {
+        audio_trace_reader trace;
+        if(!trace.open(argv[0])) {
+            fprintf(stderr, "couldn't open \"%s\" as a binary audio trace\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        audio.set_rates(trace.clock_rate, sampling_rate);
 
-int main(int argc, const char **argv)
-{
-    clk_t current_clock = 0;
+        if(threads > 1) {
+
+            render_parallel(trace, threads);
+
+        } else {
 
-    unsigned char regname[512];
-    clk_t next_write_clock;
-    uint32_t next_write_address;
-    uint32_t next_write_value;
+            clk_t next_write_clock;
+            uint8_t next_write_address;
+            uint8_t next_write_value;
 
-    while(scanf("%[^,],%llu,%d,%d ", regname, &next_write_clock, &next_write_address, &next_write_value) == 4) {
-        while(current_clock < next_write_clock) {
-            advance_audio_clock();
-            current_clock++;
+            while(trace.next(next_write_clock, next_write_address, next_write_value)) {
+                if(next_write_address < 0x80) {
+                    audio.write(next_write_address, next_write_value, next_write_clock);
+                    if(audio.samples_available() >= 4096) {
+                        emit_samples();
+                    }
+                }
+            }
         }
-        tia_write[next_write_address] = next_write_value;
+        trace_bytes = trace.size;
+        trace.close();
+
+    } else {
+
+        unsigned char regname[512];
+        clk_t next_write_clock;
+        uint32_t next_write_address;
+        uint32_t next_write_value;
+
+        while(scanf("%[^,],%llu,%d,%d ", regname, &next_write_clock, &next_write_address, &next_write_value) == 4) {
+            audio.write(next_write_address, next_write_value, next_write_clock);
+            if(audio.samples_available() >= 4096) {
+                emit_samples();
+            }
+        }
+        long consumed = ftell(stdin); // -1 if stdin is a pipe
+        trace_bytes = (consumed > 0) ? consumed : 0;
+    }
+
+    emit_samples();
+    flush_samples();
+
+    if(timing) {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        fprintf(stderr, "converted %.2f MB of trace in %f seconds, %.1f MB/s\n",
+            trace_bytes / 1e6, elapsed.count(), trace_bytes / 1e6 / elapsed.count());
     }
 }
@@ -0,0 +1,53 @@
+/*
+    Lock-free triple buffer
+
+    One thread fills back() and calls publish(); another calls update()
+    and reads front().  The third buffer sits between them, so the
+    producer never waits for the consumer and the consumer always gets
+    the newest complete buffer, skipping any it was too slow to see.
+*/
+
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+template <class T>
+struct triple_buffer
+{
+    static constexpr int index_mask = 0x3;
+    static constexpr int fresh = 0x4; // middle was published and not yet taken
+
+    T buffers[3];
+    std::atomic<int> middle{1};
+    int back_index = 0; // producer's own
+    int front_index = 2; // consumer's own
+
+    T& back()
+    {
+        return buffers[back_index];
+    }
+
+    // Producer: hand back() over and get a new back() to fill
+    void publish()
+    {
+        back_index = middle.exchange(back_index | fresh, std::memory_order_acq_rel) & index_mask;
+    }
+
+    // Consumer: returns true if front() is now a newer buffer
+    bool update()
+    {
+        if(!(middle.load(std::memory_order_relaxed) & fresh)) {
+            return false;
+        }
+        front_index = middle.exchange(front_index, std::memory_order_acq_rel) & index_mask;
+        return true;
+    }
+
+    const T& front() const
+    {
+        return buffers[front_index];
+    }
+};
+
+#endif /* TRIPLE_BUFFER_H */
@@ -0,0 +1,189 @@
+/*
+    Video capture
+
+    With --video, every frame emulation finishes is copied into a slot
+    from a preallocated pool and handed to a writer thread, which
+    converts and writes it, so recording never blocks emulation on
+    file or pipe I/O.  If the writer falls a whole pool behind, emulation
+    waits for a slot instead of dropping a frame.  A filename starting
+    with "|" is run as a command with the video on its standard input,
+    e.g. --video "|ffmpeg -i - out.mp4".
+
+    Formats:
+
+        y4m     YUV4MPEG2 with 4:4:4 BT.601 limited-range color, which
+                encoders read directly
+        raw     the 256-entry RGB palette, then each frame as one
+                palette index per pixel, row by row
+        gray    each frame as one 8-bit luma byte per pixel, no header
+        rgb     each frame as R, G, B bytes per pixel, no header
+        obs     each frame as an 84x84 gray observation for learning
+                agents (observation.h), no header
+
+    The others hold the whole TIA frame including horizontal blank, and
+    pixels are about twice as wide as they are tall.  Frames are
+    queued as palette indices and only the writer converts them.
+*/
+
+#ifndef VIDEO_CAPTURE_H
+#define VIDEO_CAPTURE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <thread>
+#include <vector>
+
+#include "ring_buffer.h"
+#include "frame_convert.h"
+#include "observation.h"
+
+namespace VideoCapture
+{
+    enum format { Y4M, RAW, GRAY, RGB, OBS };
+};
+
+struct video_capture
+{
+    static constexpr size_t pool_size = 16;
+
+    FILE *file = nullptr;
+    bool is_pipe = false;
+    VideoCapture::format format = VideoCapture::Y4M;
+    int width = 0;
+    int height = 0;
+    const Palette::tables *palette = nullptr;
+    frame_converter converter; // for GRAY and RGB
+    observation_builder observer; // for OBS, whose area is set before open()
+
+    std::vector<uint8_t> pool;
+    std::vector<uint8_t> planes; // writer's conversion buffer
+    spsc_ring_buffer<uint8_t, pool_size> free_slots; // writer to emulation
+    spsc_ring_buffer<uint8_t, pool_size> full_slots; // emulation to writer
+    std::atomic<bool> running{false};
+    std::thread writer;
+    uint64_t frames_written = 0;
+    uint64_t stalls = 0; // times emulation waited on the writer
+
+    bool open(const char *filename, VideoCapture::format format_, int width_, int height_,
+        const Palette::tables& palette_, uint32_t rate_numerator, uint32_t rate_denominator)
+    {
+        if(filename[0] == '|') {
+            file = popen(filename + 1, "w");
+            is_pipe = true;
+        } else {
+            file = fopen(filename, "wb");
+        }
+        if(file == nullptr) {
+            return false;
+        }
+        setvbuf(file, nullptr, _IOFBF, 1 << 20);
+        format = format_;
+        width = width_;
+        height = height_;
+        palette = &palette_;
+        converter.set_palette(palette_);
+        observer.converter.set_palette(palette_);
+
+        if(format == VideoCapture::Y4M) {
+            fprintf(file, "YUV4MPEG2 W%d H%d F%u:%u Ip A2:1 C444 XCOLORRANGE=LIMITED\n",
+                width, height, rate_numerator, rate_denominator);
+        } else if(format == VideoCapture::RAW) {
+            for(int i = 0; i < 256; i++) {
+                fwrite(&palette->colors[i >> 1], 3, 1, file);
+            }
+        }
+
+        pool.resize(pool_size * width * height);
+        planes.resize(width * height * 3);
+        for(uint8_t slot = 0; slot < pool_size; slot++) {
+            free_slots.push(&slot, 1);
+        }
+        running = true;
+        writer = std::thread([this]{ write_loop(); });
+        return true;
+    }
+
+    // Emulation: queue a copy of a finished frame of palette indices
+    void add_frame(const uint8_t *pixels)
+    {
+        uint8_t slot;
+        if(free_slots.pop(&slot, 1) == 0) {
+            stalls++;
+            while(free_slots.pop(&slot, 1) == 0) {
+                std::this_thread::yield();
+            }
+        }
+        memcpy(pool.data() + slot * width * height, pixels, width * height);
+        full_slots.push(&slot, 1);
+    }
+
+    void write_frame(const uint8_t *pixels)
+    {
+        size_t size = width * height;
+        if(format == VideoCapture::Y4M) {
+            for(int plane = 0; plane < 3; plane++) {
+                const uint8_t *table = palette->ycbcr[plane];
+                uint8_t *out = planes.data() + plane * size;
+                for(size_t i = 0; i < size; i++) {
+                    out[i] = table[pixels[i] >> 1];
+                }
+            }
+            fputs("FRAME\n", file);
+            fwrite(planes.data(), planes.size(), 1, file);
+        } else if(format == VideoCapture::GRAY) {
+            converter.to_gray(pixels, size, planes.data());
+            fwrite(planes.data(), size, 1, file);
+        } else if(format == VideoCapture::RGB) {
+            converter.to_rgb24(pixels, size, planes.data());
+            fwrite(planes.data(), size * 3, 1, file);
+        } else if(format == VideoCapture::OBS) {
+            observer.build(pixels, width, planes.data());
+            fwrite(planes.data(), observation_builder::width * observation_builder::height, 1, file);
+        } else {
+            fwrite(pixels, size, 1, file);
+        }
+        frames_written++;
+    }
+
+    void write_loop()
+    {
+        using namespace std::chrono_literals;
+        while(true) {
+            // Check before popping so every frame queued before close() is written
+            bool stopping = !running;
+            uint8_t slot;
+            if(full_slots.pop(&slot, 1) == 0) {
+                if(stopping) {
+                    return;
+                }
+                std::this_thread::sleep_for(1ms);
+                continue;
+            }
+            write_frame(pool.data() + slot * width * height);
+            free_slots.push(&slot, 1);
+        }
+    }
+
+    // Writes everything queued, then closes the file or waits for the command
+    void close()
+    {
+        if(file == nullptr) {
+            return;
+        }
+        running = false;
+        writer.join();
+        if(is_pipe) {
+            pclose(file);
+        } else {
+            fclose(file);
+        }
+        file = nullptr;
+        fprintf(stderr, "wrote %llu video frames, emulation waited on the writer %llu times\n",
+            (unsigned long long)frames_written, (unsigned long long)stalls);
+    }
+};
+
+#endif /* VIDEO_CAPTURE_H */
@@ -0,0 +1,229 @@
+/*
+    Audio recording to WAV or raw PCM
+
+    With --wav, emulation renders a second copy of the TIA audio at a
+    fixed sample rate, free of the small rate adjustments that keep the
+    live audio device fed, and posts the samples onto a large lock-free
+    ring.  A writer thread drains the ring to the file, so recording
+    costs emulation one copy per scanline whether running in real time
+    or headless at full speed.  If the writer falls a whole ring behind,
+    write() waits for room rather than drop audio.
+
+    Samples are stereo, interleaved, and little-endian on any host, as
+    are the header's fields, in one of
+
+        u8      unsigned 8-bit, as the live audio device gets
+        s16     signed 16-bit, keeping the synthesizer's sub-step
+                precision
+        float   32-bit IEEE float, 1.0 at full scale
+
+    A filename ending in ".raw" gets the bare samples with no header.
+    The WAV header's sizes are filled in when the file is closed.  They
+    are 32 bits, so a WAV stops recording with a warning at 4 GiB, about
+    3 hours of 48 kHz float; raw files have no limit.
+*/
+
+#ifndef WAV_WRITER_H
+#define WAV_WRITER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <thread>
+
+#include "ring_buffer.h"
+
+namespace WAV
+{
+    enum format { U8, S16, FLOAT };
+
+    static constexpr uint32_t default_sample_rate = 48000;
+    static constexpr uint16_t channels = 2;
+
+    inline size_t bytes_per_sample(format f)
+    {
+        return (f == U8) ? 1 : ((f == S16) ? 2 : 4);
+    }
+
+    inline bool host_is_little_endian()
+    {
+        uint16_t probe = 1;
+        uint8_t first;
+        memcpy(&first, &probe, 1);
+        return first == 1;
+    }
+}
+
+struct wav_writer
+{
+    FILE *file = nullptr;
+    bool has_header = false;
+    WAV::format format = WAV::S16;
+    uint32_t sample_rate = WAV::default_sample_rate;
+
+    spsc_ring_buffer<uint8_t, 1 << 20> queue;
+    std::atomic<bool> running{false};
+    std::thread writer;
+    uint64_t data_bytes = 0; // writer's own
+    uint64_t stalls = 0; // emulation's own
+    bool full = false; // writer's own, reached max_data_bytes()
+
+    bool open(const char *filename, WAV::format format_, uint32_t sample_rate_)
+    {
+        file = fopen(filename, "wb");
+        if(file == nullptr) {
+            return false;
+        }
+        format = format_;
+        sample_rate = sample_rate_;
+        size_t length = strlen(filename);
+        has_header = (length < 4) || (strcmp(filename + length - 4, ".raw") != 0);
+        if(has_header) {
+            write_header();
+        }
+        running = true;
+        writer = std::thread([this]{ write_loop(); });
+        return true;
+    }
+
+    uint16_t block_align() const
+    {
+        return WAV::channels * WAV::bytes_per_sample(format);
+    }
+
+    uint32_t fmt_size() const
+    {
+        return (format == WAV::FLOAT) ? 18 : 16;
+    }
+
+    uint32_t fact_size() const
+    {
+        return (format == WAV::FLOAT) ? 12 : 0;
+    }
+
+    // Most whole sample frames the RIFF size field can cover
+    uint64_t max_data_bytes() const
+    {
+        uint64_t overhead = 4 + (8 + fmt_size()) + fact_size() + 8;
+        return (UINT32_MAX - overhead) / block_align() * block_align();
+    }
+
+    // RIFF sizes are placeholders until close() rewrites the header
+    void write_header()
+    {
+        bool is_float = (format == WAV::FLOAT);
+        uint16_t block_align = this->block_align();
+        uint32_t fmt_size = this->fmt_size();
+        uint32_t fact_size = this->fact_size();
+        uint32_t riff_size = 4 + (8 + fmt_size) + fact_size + 8 + (uint32_t)data_bytes;
+
+        uint8_t header[64];
+        size_t size = 0;
+        auto bytes = [&](const void *p, size_t n) { memcpy(header + size, p, n); size += n; };
+        auto u16 = [&](uint16_t v) { header[size++] = v; header[size++] = v >> 8; };
+        auto u32 = [&](uint32_t v) { u16(v); u16(v >> 16); };
+
+        bytes("RIFF", 4);
+        u32(riff_size);
+        bytes("WAVE", 4);
+        bytes("fmt ", 4);
+        u32(fmt_size);
+        u16(is_float ? 3 : 1); // WAVE_FORMAT_IEEE_FLOAT or WAVE_FORMAT_PCM
+        u16(WAV::channels);
+        u32(sample_rate);
+        u32(sample_rate * block_align);
+        u16(block_align);
+        u16(WAV::bytes_per_sample(format) * 8);
+        if(is_float) {
+            u16(0); // no extension
+            bytes("fact", 4);
+            u32(4);
+            u32((uint32_t)(data_bytes / block_align));
+        }
+        bytes("data", 4);
+        u32((uint32_t)data_bytes);
+        fwrite(header, size, 1, file);
+    }
+
+    // Emulation: queue interleaved samples in the file's format, in the
+    // host's byte order
+    void write(const void *samples, size_t size)
+    {
+        size_t width = WAV::bytes_per_sample(format);
+        if((width == 1) || WAV::host_is_little_endian()) {
+            push(samples, size);
+            return;
+        }
+        const uint8_t *in = static_cast<const uint8_t*>(samples);
+        uint8_t swapped[1024]; // whole samples of any width
+        while(size > 0) {
+            size_t n = std::min(size, sizeof(swapped));
+            for(size_t i = 0; i < n; i += width) {
+                std::reverse_copy(in + i, in + i + width, swapped + i);
+            }
+            push(swapped, n);
+            in += n;
+            size -= n;
+        }
+    }
+
+    void push(const void *samples, size_t size)
+    {
+        const uint8_t *bytes = static_cast<const uint8_t*>(samples);
+        size_t queued = queue.push(bytes, size);
+        if(queued < size) {
+            stalls++;
+            do {
+                std::this_thread::yield();
+                queued += queue.push(bytes + queued, size - queued);
+            } while(queued < size);
+        }
+    }
+
+    void write_loop()
+    {
+        using namespace std::chrono_literals;
+        static uint8_t chunk[1 << 16];
+        while(true) {
+            // Check before popping so everything queued before close() is written
+            bool stopping = !running;
+            size_t count = queue.pop(chunk, sizeof(chunk));
+            if(count > 0) {
+                if(has_header && (data_bytes + count > max_data_bytes())) {
+                    count = max_data_bytes() - data_bytes;
+                    if(!full) {
+                        fprintf(stderr, "WAV file is at its 4 GiB limit; no more audio will be recorded, use a .raw file for longer\n");
+                        full = true;
+                    }
+                }
+                fwrite(chunk, count, 1, file);
+                data_bytes += count;
+            } else if(stopping) {
+                return;
+            } else {
+                std::this_thread::sleep_for(1ms);
+            }
+        }
+    }
+
+    void close()
+    {
+        if(file == nullptr) {
+            return;
+        }
+        running = false;
+        writer.join();
+        if(has_header && (fseek(file, 0, SEEK_SET) == 0)) {
+            write_header();
+        }
+        fclose(file);
+        file = nullptr;
+        fprintf(stderr, "wrote %llu bytes of audio, emulation waited on the writer %llu times\n",
+            (unsigned long long)data_bytes, (unsigned long long)stalls);
+    }
+};
+
+#endif /* WAV_WRITER_H */